@@ -1,303 +1,618 @@
-
-/* Name: main.c
- * Project: AVR USB driver for CDC interface on Low-Speed USB
- *              for ATtiny2313
- * Author: Osamu Tamura
- * Creation Date: 2007-10-03
- * Modified by Rada Berar on 28.11.2016. for the purposes of USB Pulse Generator
- * Copyright: (c) 2007-2009 by Recursion Co., Ltd.
- * License: Proprietary, free under certain conditions. See Documentation.
- *
- */
-
-#include <string.h>
-#include <avr/io.h>
-#include <avr/interrupt.h>
-#include <avr/pgmspace.h>
-#include <avr/wdt.h>
-#include <stdint.h>
-#include <stdbool.h>
-#include <avr/eeprom.h>
-#include "usbdrv/usbdrv.h"
-
-
-#define HW_CDC_BULK_OUT_SIZE     8
-#define HW_CDC_BULK_IN_SIZE      8
-#define TX_SIZE        			(HW_CDC_BULK_OUT_SIZE)
-#define USART_BAUDRATE 	(9600)
-#define BAUD_PRESCALE 	(((( F_CPU / 16) + ( USART_BAUDRATE / 2) ) / ( USART_BAUDRATE ) ) - 1)
-#define waitTxReady()	while (( UCSRA & (1 << UDRE ) ) == 0)
-
-enum {
-    SEND_ENCAPSULATED_COMMAND = 0,
-    GET_ENCAPSULATED_RESPONSE,
-    SET_COMM_FEATURE,
-    GET_COMM_FEATURE,
-    CLEAR_COMM_FEATURE,
-    SET_LINE_CODING = 0x20,
-    GET_LINE_CODING,
-    SET_CONTROL_LINE_STATE,
-    SEND_BREAK
-};
-
-enum{
-	CMD_SET_PAUSE = 0,
-	CMD_SET_PULSE = 1,
-	CMD_STORE = 2, 		/* Save in EEPROM */
-	CMD_UNKNOWN
-};
-
-static uint8_t to_host_buf[TX_SIZE];
-static uint8_t txReadyFlag = 0;
-uint8_t txidx;
-
-const PROGMEM char configDescrCDC[] = {   /* USB configuration descriptor */
-    9,          /* sizeof(usbDescrConfig): length of descriptor in bytes */
-    USBDESCR_CONFIG,    /* descriptor type */
-    67,
-    0,          /* total length of data returned (including inlined descriptors) */
-    2,          /* number of interfaces in this configuration */
-    1,          /* index of this configuration */
-    0,          /* configuration name string index */
-#if USB_CFG_IS_SELF_POWERED
-    (1 << 7) | USBATTR_SELFPOWER,       /* attributes */
-#else
-    (1 << 7),                           /* attributes */
-#endif
-    USB_CFG_MAX_BUS_POWER/2,            /* max USB current in 2mA units */
-
-    /* interface descriptor follows inline: */
-    9,          /* sizeof(usbDescrInterface): length of descriptor in bytes */
-    USBDESCR_INTERFACE, /* descriptor type */
-    0,          /* index of this interface */
-    0,          /* alternate setting for this interface */
-    USB_CFG_HAVE_INTRIN_ENDPOINT,   /* endpoints excl 0: number of endpoint descriptors to follow */
-    USB_CFG_INTERFACE_CLASS,
-    USB_CFG_INTERFACE_SUBCLASS,
-    USB_CFG_INTERFACE_PROTOCOL,
-    0,          /* string index for interface */
-
-    /* CDC Class-Specific descriptor */
-    5,           /* sizeof(usbDescrCDC_HeaderFn): length of descriptor in bytes */
-    0x24,        /* descriptor type */
-    0,           /* header functional descriptor */
-    0x10, 0x01,
-
-    4,           /* sizeof(usbDescrCDC_AcmFn): length of descriptor in bytes */
-    0x24,        /* descriptor type */
-    2,           /* abstract control management functional descriptor */
-    0x02,        /* SET_LINE_CODING,    GET_LINE_CODING, SET_CONTROL_LINE_STATE    */
-
-    5,           /* sizeof(usbDescrCDC_UnionFn): length of descriptor in bytes */
-    0x24,        /* descriptor type */
-    6,           /* union functional descriptor */
-    0,           /* CDC_COMM_INTF_ID */
-    1,           /* CDC_DATA_INTF_ID */
-
-    5,           /* sizeof(usbDescrCDC_CallMgtFn): length of descriptor in bytes */
-    0x24,        /* descriptor type */
-    1,           /* call management functional descriptor */
-    3,           /* allow management on data interface, handles call management by itself */
-    1,           /* CDC_DATA_INTF_ID */
-
-    /* Endpoint Descriptor */
-    7,           /* sizeof(usbDescrEndpoint) */
-    USBDESCR_ENDPOINT,  /* descriptor type = endpoint */
-    0x83,        /* IN endpoint number 3 */
-    0x03,        /* attrib: Interrupt endpoint */
-    8, 0,        /* maximum packet size */
-    USB_CFG_INTR_POLL_INTERVAL,        /* in ms */
-
-    /* Interface Descriptor  */
-    9,           /* sizeof(usbDescrInterface): length of descriptor in bytes */
-    USBDESCR_INTERFACE,           /* descriptor type */
-    1,           /* index of this interface */
-    0,           /* alternate setting for this interface */
-    2,           /* endpoints excl 0: number of endpoint descriptors to follow */
-    0x0A,        /* Data Interface Class Codes */
-    0,
-    0,           /* Data Interface Class Protocol Codes */
-    0,           /* string index for interface */
-
-    /* Endpoint Descriptor */
-    7,           /* sizeof(usbDescrEndpoint) */
-    USBDESCR_ENDPOINT,  /* descriptor type = endpoint */
-    0x01,        /* OUT endpoint number 1 */
-    0x02,        /* attrib: Bulk endpoint */
-    HW_CDC_BULK_OUT_SIZE, 0,        /* maximum packet size */
-    0,           /* in ms */
-
-    /* Endpoint Descriptor */
-    7,           /* sizeof(usbDescrEndpoint) */
-    USBDESCR_ENDPOINT,  /* descriptor type = endpoint */
-    0x81,        /* IN endpoint number 1 */
-    0x02,        /* attrib: Bulk endpoint */
-    HW_CDC_BULK_IN_SIZE, 0,        /* maximum packet size */
-    0,           /* in ms */
-};
-
-uint8_t EEMEM helpResponse[] =
-		"FE, FF, 00, <4 byte value> :pause \n"
-		"FE, FF, 01, <4 byte value> :pulse \n"
-		"FE, FF, 02 :save current setup\nUnits are in 0,1us.";
-
-uchar usbFunctionDescriptor(usbRequest_t *rq)
-{
-
-    if(rq->wValue.bytes[1] == USBDESCR_DEVICE){
-        usbMsgPtr = (uchar *)usbDescriptorDevice;
-        return usbDescriptorDevice[0];
-    }else{  /* must be config descriptor */
-        usbMsgPtr = (uchar *)configDescrCDC;
-        return sizeof(configDescrCDC);
-    }
-}
-
-/* ------------------------------------------------------------------------- */
-/* ----------------------------- USB interface ----------------------------- */
-/* ------------------------------------------------------------------------- */
-
-static uchar    modeBuffer[7];
-
-uchar usbFunctionSetup(uchar data[8])
-{
-	usbRequest_t    *rq = (void *)data;
-
-    if((rq->bmRequestType & USBRQ_TYPE_MASK) == USBRQ_TYPE_CLASS){    /* class request type */
-
-        if( rq->bRequest==GET_LINE_CODING || rq->bRequest==SET_LINE_CODING ){
-            return 0xff;
-        /*    GET_LINE_CODING -> usbFunctionRead()    */
-        /*    SET_LINE_CODING -> usbFunctionWrite()   */
-        }
-    }
-    return 0;
-}
-
-/*---------------------------------------------------------------------------*/
-/* usbFunctionRead -  GET_LINE_CODING                                       */
-/*---------------------------------------------------------------------------*/
-
-uchar usbFunctionRead( uchar *data, uchar len )
-{
-    memcpy( data, modeBuffer, 7 );
-    return 7;
-}
-
-/*---------------------------------------------------------------------------*/
-/* usbFunctionWrite  -  SET_LINE_CODING                                      */
-/*---------------------------------------------------------------------------*/
-
-uchar usbFunctionWrite( uchar *data, uchar len )
-{
-    memcpy( modeBuffer, data, 7 );
-    return 1;
-}
-
-/*---------------------------------------------------------------------------*/
-/* usbFunctionWriteOut					                                     */
-/*---------------------------------------------------------------------------*/
-
-
-void usbFunctionWriteOut( uchar *data, uchar len )
-{
-	to_host_buf[0] = 1;	/* Acknowledge response */
-
-	if((data[0] == 'h') && (data[1] == 'e') && (data[2] == 'l') && (data[3] == 'p')){
-		txReadyFlag = 2;
-		txidx = 0;
-	}else{
-		txReadyFlag = 1;
-
-		if((data[0] == 0xFE) && (data[1] == 0xFF) && (data[2] < CMD_UNKNOWN)){
-			uint8_t i;
-			uint8_t msgLen = 0;
-
-			/*  postpone receiving next data    */
-//			usbDisableAllRequests();
-
-
-			if(data[2] == CMD_STORE){
-				msgLen = 3;
-			}else if(len > 6){
-				msgLen = 7;
-			}else{
-				to_host_buf[0] = 0;	/* Error response */
-			}
-
-			for(i=2; i<msgLen; i++){
-				waitTxReady();
-				UDR = data[i];
-			}
-
-//			usbEnableAllRequests();
-		}
-	}
-}
-
-
-static void hardwareInit(void)
-{
-unsigned	i;
-uchar		j;
-
-    /* activate pull-ups except on USB lines */
-    USB_CFG_IOPORT   = (uchar)~((1<<USB_CFG_DMINUS_BIT)|(1<<USB_CFG_DPLUS_BIT));
-    /* all pins input except USB (-> USB reset) */
-    USBDDR    = (1<<USB_CFG_DMINUS_BIT)|(1<<USB_CFG_DPLUS_BIT);
-
-    j = 15;
-    while(--j){          /* USB Reset by device only required on Watchdog Reset */
-        i = 0;
-        while(--i)
-            wdt_reset();
-    }
-
-    USBDDR    = 0;      /*  remove USB reset condition */
-
-	PORTB	= 0xff;
-
-	UBRRL = (unsigned char)BAUD_PRESCALE;
-	UBRRH = (BAUD_PRESCALE >> 8);
-//	UCSRA   = (1<<U2X);
-	UCSRB	= (1<<TXEN);
-
-}
-
-
-int main(void)
-{
-    hardwareInit();
-    usbInit();
-
-    sei();
-    for(;;){    /* main event loop */
-        wdt_reset();
-        usbPoll();
-
-        /*    device => host     */
-        if( usbInterruptIsReady()) {
-        	if(txReadyFlag == 1){
-        		usbSetInterrupt(to_host_buf, 1);
-        		txReadyFlag = 0;
-        	}else if(txReadyFlag == 2){
-
-        		uint8_t len;
-
-        		if((sizeof(helpResponse) - 7) > txidx){
-        			len = 7;
-        		}else{
-        			len = sizeof(helpResponse) - txidx;
-        			txReadyFlag = 0;
-        		}
-
-        		eeprom_read_block(to_host_buf, &helpResponse[txidx], len);
-        		usbSetInterrupt(to_host_buf, len);
-
-        		txidx += len;
-        	}
-        }
-    }
-    return 0;
-}
-
+
+/* Name: main.c
+ * Project: AVR USB driver for CDC interface on Low-Speed USB
+ *              for ATtiny2313
+ * Author: Osamu Tamura
+ * Creation Date: 2007-10-03
+ * Modified by Rada Berar on 28.11.2016. for the purposes of USB Pulse Generator
+ * Copyright: (c) 2007-2009 by Recursion Co., Ltd.
+ * License: Proprietary, free under certain conditions. See Documentation.
+ *
+ */
+
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/wdt.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <avr/eeprom.h>
+#include <util/delay.h>
+#include <util/crc16.h>
+#include "usbdrv/usbdrv.h"
+
+
+#define HW_CDC_BULK_OUT_SIZE     8
+#define HW_CDC_BULK_IN_SIZE      8
+#define TX_SIZE        			(HW_CDC_BULK_OUT_SIZE)
+#define UBRR_U2X(baud)	((((F_CPU / 8) + ((baud) / 2)) / (baud)) - 1)
+#define LINK_ACK		(0x5A)
+#define LINK_SYNC		(0x7E)
+#define LINK_ESC		(0x7D)
+#define LINK_ACK_WAIT	(500)	/* x 10us, ack at 9600 plus a busy generator */
+#define LINK_MAX		(LINK_38400)	/* two RX bytes must outlast a USB message (100us) */
+#define RX_RING			(16)	/* power of 2, generator bytes waiting for the host */
+#define waitTxReady()	while (( UCSRA & (1 << UDRE ) ) == 0)
+
+enum {
+    SEND_ENCAPSULATED_COMMAND = 0,
+    GET_ENCAPSULATED_RESPONSE,
+    SET_COMM_FEATURE,
+    GET_COMM_FEATURE,
+    CLEAR_COMM_FEATURE,
+    SET_LINE_CODING = 0x20,
+    GET_LINE_CODING,
+    SET_CONTROL_LINE_STATE,
+    SEND_BREAK
+};
+
+enum{
+	CMD_SET_PAUSE = 0,
+	CMD_SET_PULSE = 1,
+	CMD_STORE = 2, 		/* Save in EEPROM */
+	CMD_PRESET_STORE = 3,
+	CMD_PRESET_RECALL = 4,
+	CMD_PRESET_BOOT = 5,
+	CMD_STOP = 6,
+	CMD_RUN = 7,
+	CMD_TIMEBASE = 8,
+	CMD_EXT_DIVIDE = 9,
+	CMD_MEASURE = 10,
+	CMD_MEASURE_REPORT = 11,
+	CMD_STATUS = 12,
+	CMD_LINK_RATE = 13,
+	CMD_PRBS = 14,
+	CMD_PRBS_SEED = 15,
+	CMD_CODE_DATA = 16,
+	CMD_CODE = 17,
+	CMD_CODE_RATE = 18,
+	CMD_PWM_FRAME = 19,
+	CMD_PWM = 20,
+	CMD_STEP_RATE = 21,
+	CMD_STEP_ACCEL = 22,
+	CMD_STEP = 23,
+	CMD_QUAD = 24,
+	CMD_QUAD_INDEX = 25,
+	CMD_PLL = 26,
+	CMD_BINARY = 27,
+	CMD_PDM = 28,
+	CMD_SPREAD = 29,
+	CMD_POISSON = 30,
+	CMD_SHOT_LEN = 31,
+	CMD_SHOT = 32,
+	CMD_DELAY = 33,
+	CMD_HOP_LEN = 34,
+	CMD_HOP = 35,
+	CMD_JITTER = 36,
+	CMD_JITTER_REPORT = 37,
+	CMD_UNKNOWN
+};
+
+enum{
+	LINK_9600 = 0,
+	LINK_38400,
+	LINK_250K,
+	LINK_500K,
+	LINK_UNKNOWN
+};
+
+/* Argument bytes following each command byte */
+static const uint8_t cmdArgLen[CMD_UNKNOWN] PROGMEM = {
+	4,	/* CMD_SET_PAUSE */
+	4,	/* CMD_SET_PULSE */
+	0,	/* CMD_STORE */
+	1,	/* CMD_PRESET_STORE */
+	1,	/* CMD_PRESET_RECALL */
+	1,	/* CMD_PRESET_BOOT */
+	1,	/* CMD_STOP */
+	0,	/* CMD_RUN */
+	1,	/* CMD_TIMEBASE */
+	4,	/* CMD_EXT_DIVIDE */
+	1,	/* CMD_MEASURE */
+	0,	/* CMD_MEASURE_REPORT */
+	0,	/* CMD_STATUS */
+	1,	/* CMD_LINK_RATE */
+	4,	/* CMD_PRBS */
+	4,	/* CMD_PRBS_SEED */
+	4,	/* CMD_CODE_DATA */
+	4,	/* CMD_CODE */
+	4,	/* CMD_CODE_RATE */
+	4,	/* CMD_PWM_FRAME */
+	4,	/* CMD_PWM */
+	4,	/* CMD_STEP_RATE */
+	4,	/* CMD_STEP_ACCEL */
+	4,	/* CMD_STEP */
+	4,	/* CMD_QUAD */
+	4,	/* CMD_QUAD_INDEX */
+	4,	/* CMD_PLL */
+	4,	/* CMD_BINARY */
+	4,	/* CMD_PDM */
+	4,	/* CMD_SPREAD */
+	4,	/* CMD_POISSON */
+	4,	/* CMD_SHOT_LEN */
+	1,	/* CMD_SHOT */
+	4,	/* CMD_DELAY */
+	4,	/* CMD_HOP_LEN */
+	2,	/* CMD_HOP */
+	1,	/* CMD_JITTER */
+	0,	/* CMD_JITTER_REPORT */
+};
+
+/* UART divider for each link rate, U2X is always on */
+static const uint16_t linkUbrr[LINK_UNKNOWN] PROGMEM = {
+	UBRR_U2X(9600),
+	UBRR_U2X(38400),
+	UBRR_U2X(250000),
+	UBRR_U2X(500000),
+};
+
+static uint8_t to_host_buf[TX_SIZE];
+static uint8_t txReadyFlag = 0;
+static uint8_t ackByte;		/* kept apart, the relay uses to_host_buf while an ack waits */
+uint8_t txidx;
+static volatile uint8_t rxRing[RX_RING];	/* generator replies, relayed as they come */
+static volatile uint8_t rxHead;			/* written by the RX ISR */
+static volatile uint8_t rxTail;			/* written by the main loop */
+static uint8_t linkRate;
+static uint8_t relayLeft;		/* unescaped bytes to the end of the frame relayed, 0 between frames */
+static uint8_t relayPos;		/* unescaped bytes since its sync */
+static bool relayEsc;
+static uint16_t relayIdle;		/* main loop passes without a byte of that frame */
+
+const PROGMEM char configDescrCDC[] = {   /* USB configuration descriptor */
+    9,          /* sizeof(usbDescrConfig): length of descriptor in bytes */
+    USBDESCR_CONFIG,    /* descriptor type */
+    67,
+    0,          /* total length of data returned (including inlined descriptors) */
+    2,          /* number of interfaces in this configuration */
+    1,          /* index of this configuration */
+    0,          /* configuration name string index */
+#if USB_CFG_IS_SELF_POWERED
+    (1 << 7) | USBATTR_SELFPOWER,       /* attributes */
+#else
+    (1 << 7),                           /* attributes */
+#endif
+    USB_CFG_MAX_BUS_POWER/2,            /* max USB current in 2mA units */
+
+    /* interface descriptor follows inline: */
+    9,          /* sizeof(usbDescrInterface): length of descriptor in bytes */
+    USBDESCR_INTERFACE, /* descriptor type */
+    0,          /* index of this interface */
+    0,          /* alternate setting for this interface */
+    USB_CFG_HAVE_INTRIN_ENDPOINT,   /* endpoints excl 0: number of endpoint descriptors to follow */
+    USB_CFG_INTERFACE_CLASS,
+    USB_CFG_INTERFACE_SUBCLASS,
+    USB_CFG_INTERFACE_PROTOCOL,
+    0,          /* string index for interface */
+
+    /* CDC Class-Specific descriptor */
+    5,           /* sizeof(usbDescrCDC_HeaderFn): length of descriptor in bytes */
+    0x24,        /* descriptor type */
+    0,           /* header functional descriptor */
+    0x10, 0x01,
+
+    4,           /* sizeof(usbDescrCDC_AcmFn): length of descriptor in bytes */
+    0x24,        /* descriptor type */
+    2,           /* abstract control management functional descriptor */
+    0x02,        /* SET_LINE_CODING,    GET_LINE_CODING, SET_CONTROL_LINE_STATE    */
+
+    5,           /* sizeof(usbDescrCDC_UnionFn): length of descriptor in bytes */
+    0x24,        /* descriptor type */
+    6,           /* union functional descriptor */
+    0,           /* CDC_COMM_INTF_ID */
+    1,           /* CDC_DATA_INTF_ID */
+
+    5,           /* sizeof(usbDescrCDC_CallMgtFn): length of descriptor in bytes */
+    0x24,        /* descriptor type */
+    1,           /* call management functional descriptor */
+    3,           /* allow management on data interface, handles call management by itself */
+    1,           /* CDC_DATA_INTF_ID */
+
+    /* Endpoint Descriptor */
+    7,           /* sizeof(usbDescrEndpoint) */
+    USBDESCR_ENDPOINT,  /* descriptor type = endpoint */
+    0x83,        /* IN endpoint number 3 */
+    0x03,        /* attrib: Interrupt endpoint */
+    8, 0,        /* maximum packet size */
+    USB_CFG_INTR_POLL_INTERVAL,        /* in ms */
+
+    /* Interface Descriptor  */
+    9,           /* sizeof(usbDescrInterface): length of descriptor in bytes */
+    USBDESCR_INTERFACE,           /* descriptor type */
+    1,           /* index of this interface */
+    0,           /* alternate setting for this interface */
+    2,           /* endpoints excl 0: number of endpoint descriptors to follow */
+    0x0A,        /* Data Interface Class Codes */
+    0,
+    0,           /* Data Interface Class Protocol Codes */
+    0,           /* string index for interface */
+
+    /* Endpoint Descriptor */
+    7,           /* sizeof(usbDescrEndpoint) */
+    USBDESCR_ENDPOINT,  /* descriptor type = endpoint */
+    0x01,        /* OUT endpoint number 1 */
+    0x02,        /* attrib: Bulk endpoint */
+    HW_CDC_BULK_OUT_SIZE, 0,        /* maximum packet size */
+    0,           /* in ms */
+
+    /* Endpoint Descriptor */
+    7,           /* sizeof(usbDescrEndpoint) */
+    USBDESCR_ENDPOINT,  /* descriptor type = endpoint */
+    0x81,        /* IN endpoint number 1 */
+    0x02,        /* attrib: Bulk endpoint */
+    HW_CDC_BULK_IN_SIZE, 0,        /* maximum packet size */
+    0,           /* in ms */
+};
+
+/* The whole EEPROM, the full command table is in the generator main.c */
+uint8_t EEMEM helpResponse[] =
+		"FE FF <cmd> <args>, cmds 00-25, see generator main.c\n"
+		"00/01 <4 byte> pause/pulse in 0,1us\n"
+		"Replies 7E type len data crc8, 7D esc";
+
+uchar usbFunctionDescriptor(usbRequest_t *rq)
+{
+
+    if(rq->wValue.bytes[1] == USBDESCR_DEVICE){
+        usbMsgPtr = (uchar *)usbDescriptorDevice;
+        return usbDescriptorDevice[0];
+    }else{  /* must be config descriptor */
+        usbMsgPtr = (uchar *)configDescrCDC;
+        return sizeof(configDescrCDC);
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+/* ----------------------------- USB interface ----------------------------- */
+/* ------------------------------------------------------------------------- */
+
+static uchar    modeBuffer[7];
+
+uchar usbFunctionSetup(uchar data[8])
+{
+	usbRequest_t    *rq = (void *)data;
+
+    if((rq->bmRequestType & USBRQ_TYPE_MASK) == USBRQ_TYPE_CLASS){    /* class request type */
+
+        if( rq->bRequest==GET_LINE_CODING || rq->bRequest==SET_LINE_CODING ){
+            return 0xff;
+        /*    GET_LINE_CODING -> usbFunctionRead()    */
+        /*    SET_LINE_CODING -> usbFunctionWrite()   */
+        }
+    }
+    return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* usbFunctionRead -  GET_LINE_CODING                                       */
+/*---------------------------------------------------------------------------*/
+
+uchar usbFunctionRead( uchar *data, uchar len )
+{
+    memcpy( data, modeBuffer, 7 );
+    return 7;
+}
+
+/*---------------------------------------------------------------------------*/
+/* usbFunctionWrite  -  SET_LINE_CODING                                      */
+/*---------------------------------------------------------------------------*/
+
+uchar usbFunctionWrite( uchar *data, uchar len )
+{
+    memcpy( modeBuffer, data, 7 );
+    return 1;
+}
+
+/*---------------------------------------------------------------------------*/
+/* Link rate negotiation, see the generator main.c                           */
+/*---------------------------------------------------------------------------*/
+
+static void linkSet(uchar rate)
+{
+	uint16_t ubrr = pgm_read_word(&linkUbrr[rate]);
+
+	waitTxReady();
+	_delay_us(1100);	/* let the last byte out, one 9600 frame */
+	UBRRH = (uchar)(ubrr >> 8);
+	UBRRL = (uchar)ubrr;
+	linkRate = rate;
+}
+
+static void linkSend(uchar data)
+{
+	waitTxReady();
+	UDR = data;
+}
+
+static void linkPut(uchar data)
+{
+	if((data == LINK_SYNC) || (data == LINK_ESC)){
+		linkSend(LINK_ESC);
+		data ^= 0x20;
+	}
+	linkSend(data);
+}
+
+/* Command and arguments as one frame: sync, length, data, crc8 */
+static void linkFrame(const uchar *data, uchar len)
+{
+	uchar crc = _crc8_ccitt_update(0, len);
+
+	linkSend(LINK_SYNC);
+	linkPut(len);
+	while(len--){
+		crc = _crc8_ccitt_update(crc, *data);
+		linkPut(*data++);
+	}
+	linkPut(crc);
+}
+
+/* Hold TX low for longer than a 9600 frame, the generator drops to 9600 */
+static void linkBreak(void)
+{
+	linkSet(LINK_9600);
+	UCSRB &= ~(1 << TXEN);
+	PORTD &= ~(1 << PD1);
+	DDRD |= (1 << PD1);
+	_delay_ms(2);
+	PORTD |= (1 << PD1);
+	UCSRB |= (1 << TXEN);
+}
+
+/* Called with RXCIE off, the ack does not go through rxRing */
+static uchar linkWaitAck(void)
+{
+	unsigned i;
+
+	for(i = 0; i < LINK_ACK_WAIT; i++){
+		wdt_reset();
+		if(UCSRA & (1 << RXC)){
+			if(UDR == LINK_ACK){
+				return 1;
+			}
+		}
+		_delay_us(10);
+	}
+	return 0;
+}
+
+/* Returns 1 on success, 0 if the rate did not pass, 0xff if the generator does
+ * not answer at all */
+static uchar linkTry(uchar rate)
+{
+	uchar cmd[2] = { CMD_LINK_RATE, rate };
+
+	linkFrame(cmd, 2);
+	if(!linkWaitAck()){
+		linkBreak();
+		return 0xff;
+	}
+	linkSet(rate);
+	linkFrame(cmd, 2);
+	if(!linkWaitAck()){
+		linkBreak();
+		return 0;
+	}
+	return 1;
+}
+
+/* Fastest rate up to maxRate that passes both ways, 9600 if none does */
+static void linkNegotiate(uchar maxRate)
+{
+	UCSRB &= ~(1 << RXCIE);
+	linkBreak();
+	for(; maxRate > LINK_9600; maxRate--){
+		if(linkTry(maxRate) != 0){
+			break;
+		}
+	}
+	rxTail = rxHead;	/* whatever came before the new rate */
+	relayLeft = 0;
+	UCSRB |= (1 << RXCIE);
+}
+
+/* Follows the generator frames through the relay: sync, type, length,
+ * payload, crc8, escaped like the commands. Acks and help text only go to
+ * the host between two frames, so they never split one. */
+static void relayTrack(uchar data)
+{
+	if(data == LINK_SYNC){
+		relayLeft = 0xFF;	/* length still to come */
+		relayPos = 0;
+		relayEsc = false;
+		return;
+	}
+	if(relayLeft == 0){
+		return;
+	}
+	if(data == LINK_ESC){
+		relayEsc = true;
+		return;
+	}
+	if(relayEsc){
+		data ^= 0x20;
+		relayEsc = false;
+	}
+	if(++relayPos == 2){
+		relayLeft = data + 1;	/* payload and crc */
+	}else if(relayPos > 2){
+		relayLeft--;
+	}
+}
+
+/* Generator bytes into rxRing, a full ring drops the byte. V-USB needs sei
+ * first (see usbdrv.h), RXCIE is cleared right after it so the pending RXC can
+ * not nest, the next instruction always runs before an interrupt. */
+ISR(USART_RX_vect, ISR_NAKED)
+{
+	__asm__ __volatile__ (
+		"	sei						\n"
+		"	cbi %[ucsrb], %[rxcie]	\n"
+		"	push r24				\n"
+		"	in r24, %[sreg]			\n"
+		"	push r24				\n"
+		"	push r25				\n"
+		"	push r30				\n"
+		"	push r31				\n"
+		"	in r25, %[udr]			\n"
+		"	lds r30, %[head]		\n"
+		"	mov r24, r30			\n"
+		"	inc r24					\n"
+		"	andi r24, %[mask]		\n"
+		"	lds r31, %[tail]		\n"
+		"	cp r24, r31				\n"
+		"	breq 1f					\n"
+		"	ldi r31, 0				\n"
+		"	subi r30, lo8(-(%[ring]))	\n"
+		"	sbci r31, hi8(-(%[ring]))	\n"
+		"	st Z, r25				\n"
+		"	sts %[head], r24		\n"
+		"1:	pop r31					\n"
+		"	pop r30					\n"
+		"	pop r25					\n"
+		"	pop r24					\n"
+		"	cli						\n"	/* reti sets I, no nesting before it */
+		"	sbi %[ucsrb], %[rxcie]	\n"
+		"	andi r24, 0x7F			\n"
+		"	out %[sreg], r24		\n"
+		"	pop r24					\n"
+		"	reti					\n"
+		:
+		: [ucsrb] "I" (_SFR_IO_ADDR(UCSRB)), [rxcie] "I" (RXCIE),
+		  [udr] "I" (_SFR_IO_ADDR(UDR)), [sreg] "I" (_SFR_IO_ADDR(SREG)),
+		  [head] "i" (&rxHead), [tail] "i" (&rxTail), [ring] "i" (rxRing),
+		  [mask] "M" (RX_RING - 1)
+	);
+}
+
+/*---------------------------------------------------------------------------*/
+/* usbFunctionWriteOut					                                     */
+/*---------------------------------------------------------------------------*/
+
+
+void usbFunctionWriteOut( uchar *data, uchar len )
+{
+	ackByte = 1;	/* Acknowledge response */
+
+	if((data[0] == 'h') && (data[1] == 'e') && (data[2] == 'l') && (data[3] == 'p')){
+		txReadyFlag = 2;
+		txidx = 0;
+	}else{
+		txReadyFlag = 1;
+
+		if((data[0] == 0xFE) && (data[1] == 0xFF) && (data[2] == CMD_LINK_RATE) && (len >= 4)){
+			/* Handled here, the generator only sees the negotiation */
+			linkNegotiate((data[3] < LINK_MAX) ? data[3] : LINK_MAX);
+			ackByte = (linkRate == data[3]);
+		}else if((data[0] == 0xFE) && (data[1] == 0xFF) && (data[2] < CMD_UNKNOWN)){
+			uint8_t msgLen = 0;
+
+			/*  postpone receiving next data    */
+//			usbDisableAllRequests();
+
+
+			msgLen = 3 + pgm_read_byte(&cmdArgLen[data[2]]);
+			if(len < msgLen){
+				msgLen = 0;
+				ackByte = 0;	/* Error response */
+			}
+
+			if(msgLen){
+				linkFrame(&data[2], msgLen - 2);
+			}
+
+//			usbEnableAllRequests();
+		}
+	}
+}
+
+
+static void hardwareInit(void)
+{
+unsigned	i;
+uchar		j;
+
+    /* activate pull-ups except on USB lines */
+    USB_CFG_IOPORT   = (uchar)~((1<<USB_CFG_DMINUS_BIT)|(1<<USB_CFG_DPLUS_BIT));
+    /* all pins input except USB (-> USB reset) */
+    USBDDR    = (1<<USB_CFG_DMINUS_BIT)|(1<<USB_CFG_DPLUS_BIT);
+
+    j = 15;
+    while(--j){          /* USB Reset by device only required on Watchdog Reset */
+        i = 0;
+        while(--i)
+            wdt_reset();
+    }
+
+    USBDDR    = 0;      /*  remove USB reset condition */
+
+	PORTB	= 0xff;
+
+	UCSRA   = (1<<U2X);
+	UCSRB	= (1<<TXEN) | (1<<RXEN);
+	linkNegotiate(LINK_MAX);
+
+}
+
+
+int main(void)
+{
+    hardwareInit();
+    usbInit();
+
+    sei();
+    for(;;){    /* main event loop */
+        wdt_reset();
+        usbPoll();
+
+        /* A frame cut off by a generator reset, or stalled by an engine
+         * that does not send, holds the acks back for ~0,5s at most */
+        if(relayLeft && (rxTail == rxHead) && (++relayIdle == 0)){
+        	relayLeft = 0;
+        }
+
+        /*    device => host     */
+        if( usbInterruptIsReady()) {
+        	if((txReadyFlag == 1) && !relayLeft){
+        		usbSetInterrupt(&ackByte, 1);
+        		txReadyFlag = 0;
+        	}else if((txReadyFlag == 2) && !relayLeft){
+
+        		uint8_t len;
+
+        		if((sizeof(helpResponse) - 7) > txidx){
+        			len = 7;
+        		}else{
+        			len = sizeof(helpResponse) - txidx;
+        			txReadyFlag = 0;
+        		}
+
+        		eeprom_read_block(to_host_buf, &helpResponse[txidx], len);
+        		usbSetInterrupt(to_host_buf, len);
+
+        		txidx += len;
+        	}else if(rxTail != rxHead){
+        		/* Relay generator frames unchanged, the host splits them on
+        		 * LINK_SYNC. A waiting ack goes right after the frame end.
+        		 * to_host_buf is free here, usbSetInterrupt copies it. */
+        		uint8_t len = 0;
+        		uint8_t tail = rxTail;
+
+        		while((tail != rxHead) && (len < sizeof(to_host_buf))){
+        			if(txReadyFlag && !relayLeft){
+        				break;
+        			}
+        			relayTrack(rxRing[tail]);
+        			to_host_buf[len++] = rxRing[tail];
+        			tail = (tail + 1) & (RX_RING - 1);
+        		}
+        		relayIdle = 0;
+        		rxTail = tail;
+        		usbSetInterrupt(to_host_buf, len);
+        	}
+        }
+    }
+    return 0;
+}
+
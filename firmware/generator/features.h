@@ -0,0 +1,153 @@
+/* Name: features.h
+ * Project: AVR Pulse Generator
+ *              for ATtiny2313
+ * Author: Rada Berar
+ *
+ * Compile time selection of the engines and options built into the generator.
+ * The ATtiny2313 has 2KB of flash and 128 bytes of SRAM, so not everything fits
+ * at once. Each switch can be overridden from the compiler command line, e.g.
+ * -DFEATURE_SELFTEST=1, see the Makefile for the variants we build and for the
+ * size report. Commands of a feature that is not built are accepted and ignored.
+ * The defaults are the basic set, which leaves room for the stack; every other
+ * feature is opt-in.
+ */
+
+#ifndef __features_h_included__
+#define __features_h_included__
+
+/* The timer0 count engine (MODE_COUNT_*) is always built, it is the fallback
+ * for every duration. */
+
+#ifndef FEATURE_TOGGLE
+#define FEATURE_TOGGLE		1
+#endif
+/* Unrolled PINB toggle loops for periods below 1,5us (MODE_TOGGLE). Without it
+ * short periods run in the count engine, with its coarser limits.
+ */
+
+#ifndef FEATURE_PRESETS
+#define FEATURE_PRESETS		1
+#endif
+/* Preset log in EEPROM, commands 02 to 05. Without it the generator always
+ * starts with defaultPlan.
+ */
+
+#ifndef FEATURE_EXT_CLOCK
+#define FEATURE_EXT_CLOCK	0
+#endif
+/* External reference on T1 and the reference divider, commands 08 and 09. */
+
+#ifndef FEATURE_SELFTEST
+#define FEATURE_SELFTEST	0
+#endif
+/* Input capture self-test, commands 0A and 0B. */
+
+#ifndef FEATURE_STATUS
+#define FEATURE_STATUS		0
+#endif
+/* Status frames on TX, command 0C, RX error counters and uptime. */
+
+#ifndef FEATURE_FAST_LINK
+#define FEATURE_FAST_LINK	0
+#endif
+/* Link rate negotiation with the bridge, command 0D. Needs the TX line, without
+ * it the link stays at 9600.
+ */
+
+#ifndef FEATURE_PRBS
+#define FEATURE_PRBS		0
+#endif
+/* PRBS7 to PRBS31 on OC0A (PB2), commands 0E and 0F. */
+
+#ifndef FEATURE_LINECODE
+#define FEATURE_LINECODE	0
+#endif
+/* NRZ, NRZ-I, Manchester and UART frames on OC0A (PB2), commands 10 to 12.
+ * Uses about 30 bytes of SRAM for the payload and the chips.
+ */
+
+#ifndef FEATURE_PWM
+#define FEATURE_PWM			0
+#endif
+/* Eight channel servo style PWM on PORTB, commands 13 and 14. Uses timer1 and
+ * 56 bytes of SRAM for the two edge schedules.
+ */
+
+#ifndef FEATURE_STEPPER
+#define FEATURE_STEPPER		0
+#endif
+/* Step/dir moves with acceleration ramps, commands 15 to 17. Uses timer1 and
+ * the TX line for the end of move reply.
+ */
+
+#ifndef FEATURE_QUADRATURE
+#define FEATURE_QUADRATURE	0
+#endif
+/* Quadrature encoder A/B on OC1A and OC1B with an optional index, commands 18
+ * and 19. Uses timer1.
+ */
+
+#ifndef FEATURE_PLL
+#define FEATURE_PLL			0
+#endif
+/* Rational M/N multiple of the frequency on ICP (PD6) on OC1B (PB4), phase
+ * aligned to the input, command 1A. Uses timer1 and its capture.
+ */
+
+#ifndef FEATURE_BINARY
+#define FEATURE_BINARY		0
+#endif
+/* Binary counter on PB0..PB7, F_CPU / 2k down to F_CPU / 256k, command 1B. */
+
+#ifndef FEATURE_PDM
+#define FEATURE_PDM			0
+#endif
+/* First order sigma-delta PDM of a 16 bit level on PORTB, command 1C. */
+
+#ifndef FEATURE_SPREAD
+#define FEATURE_SPREAD		0
+#endif
+/* Spread spectrum pause and pulse on OC1B (PB4), triangle or LFSR profile with
+ * an exact mean, command 1D. Uses timer1.
+ */
+
+#ifndef FEATURE_POISSON
+#define FEATURE_POISSON		0
+#endif
+/* Poisson distributed pulses on OC1B (PB4), command 1E. Uses timer1 and a 254
+ * byte table in flash.
+ */
+
+#ifndef FEATURE_DOUBLE_PULSE
+#define FEATURE_DOUBLE_PULSE	0
+#endif
+/* Single shot double pulse on OC1B (PB4), on command or an ICP (PD6) edge,
+ * commands 1F and 20. Uses timer1 and the TX line for the end of shot reply.
+ */
+
+#ifndef FEATURE_DELAY
+#define FEATURE_DELAY		0
+#endif
+/* Delay line from ICP (PD6) to OC1B (PB4), command 21. Uses timer1, its capture,
+ * 32 bytes of SRAM for the edge queue and the TX line for overflow replies.
+ */
+
+#ifndef FEATURE_HOP
+#define FEATURE_HOP			0
+#endif
+/* Frequency hopping table of up to 8 pause, pulse and dwell entries on OC1B
+ * (PB4), commands 22 and 23. Uses timer1 and 40 bytes of SRAM for the table.
+ */
+
+#ifndef FEATURE_JITTER
+#define FEATURE_JITTER		0
+#endif
+/* Instrumentation: histogram of the period and pulse errors of the count
+ * engine seen by the self-test, commands 24 and 25. Needs FEATURE_SELFTEST, uses
+ * 12 bytes of SRAM.
+ */
+#if FEATURE_JITTER && !FEATURE_SELFTEST
+#error "FEATURE_JITTER needs FEATURE_SELFTEST"
+#endif
+
+#endif /* __features_h_included__ */
@@ -1,369 +1,3701 @@
-
-/* Name: main.c
- * Project: AVR Pulse Generator
- *              for ATtiny2313
- * Author: Rada Berar
- * Creation Date: 30.11.2016.
- *
- * commands:
- * 00 <4 byte duration in 0,1us>	set pause length
- * 01 <4 byte duration in 0,1us>	set pulse length
- * 02								store settings to EEPROM and use at next startup
- *
- */
-
-#include <string.h>
-#include <avr/io.h>
-#include <avr/interrupt.h>
-#include <avr/pgmspace.h>
-#include <avr/wdt.h>
-#include <stdint.h>
-#include <stdbool.h>
-#include <avr/eeprom.h>
-#include <util/delay.h>
-
-#define nop() 			do{ __asm__ __volatile__ ("nop"); } while (0)
-
-#define TMR0_MAX_COUNT		(250)
-#define MIN_COUNT_MODE_LEN	(50)
-
-#define USART_BAUDRATE 	(9600)
-#define BAUD_PRESCALE 	(((( F_CPU / 16) + ( USART_BAUDRATE / 2) ) / ( USART_BAUDRATE ) ) - 1)
-#define waitTxReady()	while (( UCSRA & (1 << UDRE ) ) == 0)
-#define RX_SIZE 		(6)
-#define CMD_SET_LEN		(5)
-#define CMD_STORE_LEN	(1)
-#define MAX_LEN			(0xFFFFFFFF >> 2)
-
-#define OUT_SET()		do{ PORTB = 0xFF; }while(0)
-#define OUT_CLR()		do{ PORTB = 0; }while(0)
-#define OUT_TGL()		do{ PINB = 0xFF; }while(0)
-
-#define TMR_START()	do{ TCCR0B = (1 << CS00); }while(0) /* Start timer0 with no prescaller */
-#define TMR_STOP()		do{ TCCR0B = 0; }while(0)
-#define TMR_SET_INT()	do{ TIMSK |= (1 << OCIE0A); }while(0)
-#define TMR_CLR_INT()	do{ TIMSK &= ~(1 << OCIE0A); }while(0)
-
-enum{
-	CMD_SET_PAUSE = 0,
-	CMD_SET_PULSE = 1,
-	CMD_STORE = 2, 		/* Save in EEPROM */
-	CMD_UNKNOWN
-};
-
-
-uint32_t EEMEM storePauseLen;
-uint32_t EEMEM storePulseLen;
-
-volatile uint8_t rx_buf[RX_SIZE];
-volatile uint8_t rx_index;
-volatile uint32_t pauseLen;	/* pause duration in us */
-volatile uint32_t pulseLen; /* pulse duration in us */
-volatile bool modeContinueFlag;
-volatile uint32_t tmr0CycleCount;
-
-
-static void check_command( void ){
-
-	uint8_t command = rx_buf[0];
-
-	if(command >= CMD_UNKNOWN){
-		rx_index = 0;
-	}else
-		if((rx_index == CMD_STORE_LEN) && (command == CMD_STORE)){
-
-		eeprom_update_dword(&storePauseLen, pauseLen);
-		eeprom_update_dword(&storePulseLen, pulseLen);
-		rx_index = 0;
-
-	}else if(rx_index == CMD_SET_LEN){
-
-		uint32_t value = ((uint32_t)rx_buf[1] << 24) + ((uint32_t)rx_buf[2] << 16) + ((uint32_t)rx_buf[3] << 8) + rx_buf[4];
-		if(value > MAX_LEN){
-			value = MAX_LEN;
-		}
-
-		if(command == CMD_SET_PAUSE){
-			pauseLen = value;
-			modeContinueFlag = false;
-			tmr0CycleCount = 0xFFFFFFFE;
-		}else if(command == CMD_SET_PULSE){
-			pulseLen = value;
-			modeContinueFlag = false;
-			tmr0CycleCount = 0xFFFFFFFE;
-		}
-
-		rx_index = 0;
-	}
-}
-
-
-ISR(USART_RX_vect) {
-
-	rx_buf[rx_index] = UDR;
-
-	if(rx_index < RX_SIZE){
-		rx_index++;
-	}
-
-	check_command();
-}
-
-
-static void init(void)
-{
-	ACSR |= 1 << ACD; /* Disable analog comparer to reduce power consumption */
-
-	DDRB = 0xff;
-	PORTB = 0;
-
-	/* UART init */
-	// set the baud rate
-	UBRRL = (unsigned char)BAUD_PRESCALE;
-	UBRRH = (BAUD_PRESCALE >> 8);
-	// enable rx
-	UCSRB = (1<<RXEN);
-	//  enable RX interrupt
-	UCSRB |= (1 << RXCIE);
-
-	rx_index = 0;
-
-	pauseLen = eeprom_read_dword(&storePauseLen);
-	pulseLen = eeprom_read_dword(&storePulseLen);
-
-
-	sei();
-}
-
-#define TGL_01us()		while(modeContinueFlag){		\
-			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
-			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
-			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
-			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
-			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
-			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
-			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
-			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
-			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
-			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
-			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
-			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
-			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
-			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
-			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
-			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
-			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
-			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
-			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
-			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
-			OUT_TGL(); OUT_TGL(); OUT_TGL();	}
-
-#define TGL_02us()		while(modeContinueFlag){			\
-			OUT_TGL();	nop();	OUT_TGL(); nop();	\
-			OUT_TGL();	nop();	OUT_TGL(); nop();	\
-			OUT_TGL();	nop();	OUT_TGL(); nop();	\
-			OUT_TGL();	nop();	OUT_TGL(); nop();	\
-			OUT_TGL();	nop();	OUT_TGL(); nop();	\
-			OUT_TGL();	nop();	OUT_TGL(); nop();	\
-			OUT_TGL();	nop();	OUT_TGL(); nop();	\
-			OUT_TGL();	nop();	OUT_TGL(); nop();	\
-			OUT_TGL();	nop();	OUT_TGL(); nop();	\
-			OUT_TGL();	nop();	OUT_TGL(); nop();	\
-			OUT_TGL();	nop();	OUT_TGL(); nop();	\
-			OUT_TGL();	nop();	OUT_TGL(); nop();	\
-			OUT_TGL();	nop();	OUT_TGL(); nop();	\
-			OUT_TGL();	}
-
-#define TGL_04us()		while(modeContinueFlag){			\
-			OUT_TGL();	nop();	nop();	nop();		\
-			OUT_TGL();	nop();	nop();	nop();		\
-			OUT_TGL();	nop();	nop();	nop();		\
-			OUT_TGL();	nop();	nop();	nop();		\
-			OUT_TGL();	nop();	nop();	nop();		\
-			OUT_TGL();	nop();	nop();	nop();		\
-			OUT_TGL();	nop();	nop();	nop();		\
-			OUT_TGL();	nop();	nop();	nop();		\
-			OUT_TGL();	nop();	nop();	nop();		\
-			OUT_TGL();	nop();	nop();	nop();		\
-			OUT_TGL();	}
-
-#define TGL_06us()		while(modeContinueFlag){					\
-			OUT_TGL(); nop(); nop(); nop();	nop();	nop();	\
-			OUT_TGL(); nop(); nop(); nop();	nop();	nop();	\
-			OUT_TGL(); nop(); nop(); nop();	nop();	nop();	\
-			OUT_TGL(); nop(); nop(); nop();	nop();	nop();	\
-			OUT_TGL(); nop(); nop(); nop();	nop();	nop();	\
-			OUT_TGL();}
-
-#define TGL_08us()		while(modeContinueFlag){ OUT_TGL(); nop();	}
-
-#define TGL_1us()		while(modeContinueFlag){	\
-			OUT_TGL(); nop(); nop(); nop();	}
-
-#define TGL_12us()		while(modeContinueFlag){		\
-			OUT_TGL(); nop(); nop();			\
-			nop(); nop(); nop(); }
-
-#define TGL_14us()		while(modeContinueFlag){		\
-			OUT_TGL(); nop(); nop();			\
-			nop(); nop(); nop(); nop();	nop();}
-
-#define TGL_16us()		while(modeContinueFlag){		\
-			OUT_TGL(); nop(); nop(); nop();		\
-			nop(); nop(); nop(); nop(); nop(); nop();}
-
-#define TGL_18us()		while(modeContinueFlag){		\
-			OUT_TGL(); nop(); nop(); nop();		\
-			nop(); nop(); nop(); nop();	nop();	\
-			nop(); nop(); nop();	}
-
-#define TGL_20us()		while(modeContinueFlag){		\
-			OUT_TGL(); nop(); nop(); nop();		\
-			nop(); nop(); nop(); nop();	nop();	\
-			nop(); nop(); nop(); nop();	nop(); }
-
-void doToggle( void ){
-	TMR_STOP();
-
-	modeContinueFlag = true;
-
-	uint8_t period = (uint8_t)(pauseLen + pulseLen)>>1;
-
-	switch(period){
-	case 0:
-		TGL_01us();
-		break;
-	case 1:
-		TGL_02us();
-		break;
-	case 2:
-		TGL_04us();
-		break;
-	case 3:
-		TGL_06us();
-		break;
-	case 4:
-		TGL_08us();
-		break;
-	case 5:
-		TGL_1us();
-		break;
-	case 6:
-		TGL_12us();
-		break;
-	default:
-		TGL_14us();
-		break;
-	}
-
-}
-
-
-ISR (TIMER0_COMPA_vect)
-{
-	tmr0CycleCount++;
-}
-
-
-void doCounting( void ){
-	OCR0A  = TMR0_MAX_COUNT - 1;// number to count up to.
-	TCCR0A = (1 << WGM01); 		// CTC mode
-
-	modeContinueFlag = true;
-	TMR_SET_INT();
-	tmr0CycleCount = 0;
-
-	uint32_t tempPauseLen = pauseLen * 2;
-	uint32_t tempPulseLen = pulseLen * 2;
-	uint32_t tmrLowCycleCount, tmrHighCycleCount;
-
-	tmrLowCycleCount = tempPauseLen / (uint32_t)TMR0_MAX_COUNT;
-	tmrHighCycleCount = tempPulseLen / (uint32_t)TMR0_MAX_COUNT;
-
-	TMR_START();
-	if((tmrLowCycleCount == 0) && (tmrHighCycleCount == 0)){
-
-		if(tempPauseLen > 16){
-			tempPauseLen -= 16;
-		}
-
-		if(tempPulseLen > 12){
-			tempPulseLen -= 12;
-		}
-
-		TMR_CLR_INT();
-
-		while(modeContinueFlag){
-			while(TCNT0 < tempPauseLen);
-			OUT_SET();
-			TCNT0 = 0;
-			while(TCNT0 < tempPulseLen);
-			OUT_CLR();
-			TCNT0 = 0;
-		}
-
-	}else if(tmrLowCycleCount == 0){
-		uint8_t tmrHighRemanant = (uint8_t)(tempPulseLen % TMR0_MAX_COUNT);
-
-		while(modeContinueFlag){
-			while(TCNT0 < tempPauseLen);
-			OUT_SET();
-			TCNT0 = 0;
-			tmr0CycleCount = 0;
-			while(tmr0CycleCount < tmrHighCycleCount);
-			while(TCNT0 < tmrHighRemanant);
-			OUT_CLR();
-			TCNT0 = 0;
-		}
-	}else if(tmrHighCycleCount == 0){
-		uint8_t tmrLowRemanant = (uint8_t)(tempPauseLen % TMR0_MAX_COUNT);
-
-		while(modeContinueFlag){
-			while(TCNT0 < tempPulseLen);
-			OUT_CLR();
-			TCNT0 = 0;
-			tmr0CycleCount = 0;
-			while(tmr0CycleCount < tmrLowCycleCount);
-			while(TCNT0 < tmrLowRemanant);
-			OUT_SET();
-			TCNT0 = 0;
-		}
-	}else{
-		uint8_t tmrLowRemanant = (uint8_t)(tempPauseLen % TMR0_MAX_COUNT);
-		uint8_t tmrHighRemanant = (uint8_t)(tempPulseLen % TMR0_MAX_COUNT);
-
-		while(modeContinueFlag){
-			while(tmr0CycleCount < tmrLowCycleCount);
-			while(TCNT0 < tmrLowRemanant);
-			OUT_SET();
-			TCNT0 = 0;
-			tmr0CycleCount = 0;
-			while(tmr0CycleCount < tmrHighCycleCount);
-			while(TCNT0 < tmrHighRemanant);
-			OUT_CLR();
-			TCNT0 = 0;
-			tmr0CycleCount = 0;
-		}
-	}
-
-	TMR_STOP();
-
-}
-
-
-int main(void)
-{
-	init();
-
-    for(;;){    /* main event loop */
-    	if((pauseLen < 15) && (pulseLen < 15) && ((pauseLen + pulseLen) < 15)){
-    		/* PWM mode */
-    		doToggle();
-    	}else{
-    		/* count mode */
-    		doCounting();
-    	}
-    }
-    return 0;
-}
-
+
+/* Name: main.c
+ * Project: AVR Pulse Generator
+ *              for ATtiny2313
+ * Author: Rada Berar
+ * Creation Date: 30.11.2016.
+ *
+ * commands:
+ * 00 <4 byte duration in 0,1us>	set pause length
+ * 01 <4 byte duration in 0,1us>	set pulse length
+ * 02								store settings to EEPROM and use at next startup
+ * 03 <slot>						store current settings to preset slot
+ * 04 <slot>						recall preset slot
+ * 05 <slot>						use preset slot at next startup
+ * 06 <state>						stop output: 0 hold low, 1 hold high, 2 Hi-Z
+ * 07								run (resume) output with the current plan
+ * 08 <timebase>					0 internal 20MHz crystal, 1 external reference on T1 (PD5)
+ * 09 <4 byte N>					external timebase, output = reference / N: even N from 2,
+ *									odd from 2 * EXT_MIN_TICKS + 1 = 65, others ignored
+ * 0A <window>						self-test: measure <window> periods on ICP (PD6), 0 stops
+ * 0B								send the self-test result
+ * 0C								send a status frame
+ * 0D <rate>						link rate: 0 9600, 1 38400, 2 250k, 3 500k baud
+ * 0E <poly> <3 byte period>		PRBS 0: 7, 1: 15, 2: 23, 3: 31, bit period in CPU cycles
+ * 0F <4 byte seed>				PRBS seed, 0 for all ones, restarts the sequence
+ * 10 <offset> <3 bytes>			line code payload bytes at offset
+ * 11 <code> <len> <repeat> <fmt>	send len payload bytes: code 0 NRZ, 1 NRZ-I,
+ *									2 Manchester, 3 UART; repeat 0 forever, not
+ *									with chips under 2048 cycles; fmt
+ *									bits 1..0 parity 0 none 1 even 2 odd, bit 2
+ *									two stop bits
+ * 12 <4 byte period>				line code bit period in CPU cycles, taken by the next 11,
+ *									from 20 (1Mbit/s), 40 (500kbit/s) for Manchester
+ * 13 <4 byte frame>				PWM on PB0..PB7, frame in CPU cycles, all widths 0
+ * 14 <channel> <3 byte width>		PWM width of PB<channel> in CPU cycles, from the next frame
+ * 15 <4 byte rate>					stepper top rate in steps/s, taken by the next 17
+ * 16 <4 byte acceleration>			stepper acceleration in steps/s^2, taken by the next 17
+ * 17 <dir> <3 byte steps>			stepper move: dir on PB0, step pulses on OC1B (PB4)
+ * 18 <dir> <3 byte interval>		quadrature A on OC1A (PB3), B on OC1B (PB4), CPU
+ *									cycles per count, dir 0 A leads; changes apply
+ *									at the next A edge without a restart
+ * 19 <4 byte cycles>			quadrature index on PB0 once every <cycles> A/B
+ *									cycles, 4 counts each, 0 off; restarts a
+ *									running quadrature
+ * 1A <M> <N> <range> <0>			PLL: OC1B (PB4) at M/N times the frequency on ICP
+ *									(PD6), M and N 1 to 255, timer1 range 0 /1,
+ *									1 /8, 2 /64
+ * 1B <4 byte k>					binary counter on PB0..PB7, k CPU cycles per count
+ * 1C <4 byte level>				PDM on PORTB, level 0 to 65535 of 65536 bits high,
+ *									a running PDM takes it at the next bit
+ * 1D <profile> <step> <2 byte spread>	spread spectrum pauseLen / pulseLen on OC1B
+ *									(PB4), period offsets up to +-spread CPU
+ *									cycles, profile 0 triangle in step cycles
+ *									per period, 1 LFSR
+ * 1E <4 byte rate>				Poisson pulses on OC1B (PB4), pulseLen wide, mean
+ *									rate in pulses/s
+ * 1F <n> <3 byte cycles>			double pulse durations: n 0 first pulse, 1 gap,
+ *									2 second pulse, in CPU cycles
+ * 20 <source>						double pulse on OC1B (PB4): 0 now, 1 at a rising,
+ *									2 at a falling edge on ICP (PD6), once
+ * 21 <4 byte delay>				delay line, ICP (PD6) edges on OC1B (PB4) delay
+ *									CPU cycles later
+ * 22 <field,n> <3 byte value>		hop table entry n (low nibble, 0 to 7), field
+ *									(high nibble) 0 pause, 1 pulse in timer1 ticks,
+ *									2 dwell in periods (1 to 256)
+ * 23 <count> <clock>				hop through entries 0 to count-1 on OC1B (PB4),
+ *									timer1 at F_CPU / 1, 8, 64, 256, 1024 for clock
+ *									1 to 5
+ * 24 <width>						clear the jitter histogram, bins 2^width CPU
+ *									cycles wide (0 to 13), count engine only
+ * 25								send the jitter histogram
+ *
+ * Commands come framed from the bridge, replies go back on TX; framing, timing
+ * and the engines are described in DESIGN.md.
+ *
+ */
+
+#include <string.h>
+#include <stddef.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/wdt.h>
+#include <avr/sleep.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <avr/eeprom.h>
+#include <util/delay.h>
+#include <util/crc16.h>
+#include <util/atomic.h>
+#include "features.h"
+
+#define HAVE_REPLY		(FEATURE_SELFTEST || FEATURE_STATUS || FEATURE_STEPPER || FEATURE_DOUBLE_PULSE \
+						|| FEATURE_DELAY)
+#define HAVE_TX			(HAVE_REPLY || FEATURE_FAST_LINK)
+
+#define nop() 			do{ __asm__ __volatile__ ("nop"); } while (0)
+
+#define TMR0_MAX_COUNT		(250)
+#define MIN_COUNT_MODE_LEN	(50)
+
+#define UBRR_U2X(baud)	((((F_CPU / 8) + ((baud) / 2)) / (baud)) - 1)
+#define LINK_ACK		(0x5A)
+#define waitTxReady()	while (( UCSRA & (1 << UDRE ) ) == 0)
+#define RX_SIZE 		(5)		/* command and the longest argument */
+#define LINK_SYNC		(0x7E)
+#define LINK_ESC		(0x7D)
+#define RX_HUNT			(0xFF)	/* rxLen while waiting for LINK_SYNC */
+#define PRESET_COUNT	(4)
+#define PRESET_VERSION	(2)		/* bump when record_t, plan_t or the mode ids change */
+#define LOG_SIZE		(E2END / sizeof(record_t))	/* one byte left for bootSlot */
+#define LOG_NONE		(0xFF)
+#define EE_JOB_BOOT		(0x80)
+#define MAX_LEN			(0xFFFFFFFF >> 2)
+#define PHASE_LOW		(1 << 0)
+#define PHASE_HIGH		(1 << 1)
+#define PRBS_SET		((1 << COM0A1) | (1 << COM0A0) | (1 << WGM01))	/* CTC, set OC0A on match */
+#define PRBS_CLR		((1 << COM0A1) | (1 << WGM01))					/* CTC, clear OC0A on match */
+#define CODE_SIZE		(8)		/* payload bytes */
+#define CODE_CHIPS		(16)	/* 128 chips, 8 bytes Manchester or 12 bit UART */
+#define CODE_MIN_CHIP	(20)
+#define CODE_IRQ_CHIP	(2048)	/* shorter chips play a frame with interrupts off */
+#define PWM_CHANNELS	(8)		/* PB0..PB7 */
+#define PWM_NEAR		(100)	/* cycles, closer edges are polled in the ISR */
+#define PWM_EARLY		(80)	/* cycles, compare B ahead of an edge, covers the ISR entry */
+#define PWM_MAX_FRAME	(0xFFFF)	/* timer1 steps, top + 1 fits 16 bits */
+#define STEP_DIR		(1 << PB0)
+#define STEP_PULSE		(50)	/* cycles */
+#define STEP_MIN_CYCLES	(320)	/* shortest interval, ISR and ramp step must fit */
+#define QUAD_INDEX		(1 << PB0)
+#define QUAD_MIN		(32)	/* cycles per count, a change must beat TCNT1 to Q - 1 */
+#define QUAD_IRQ_CYCLES	(2048)	/* shorter counts take changes with interrupts off */
+#define PLL_MIN			(256)	/* ticks per half period, the ISRs must fit */
+#define PLL_NEAR		(32)	/* ticks, closer compare values could be missed */
+#define PLL_FIRST		(0xFF)	/* pllCount before the first input edge */
+#define BIN_MIN			(15)	/* cycles per count, the loop with one delay round */
+#define BIN_MAX			(782)	/* 256 delay rounds and two skips */
+#define PDM_CYCLES		(14)	/* per bit, the modulator loop */
+#define SPREAD_MIN		(400)	/* cycles per phase, the ISR fits a period */
+#define SPREAD_MAX		(20480)	/* cycles per phase, a period with offset fits 16 bits */
+#define LFSR_POLY		(0xB400)	/* x^16 + x^14 + x^13 + x^11 + 1, Galois */
+#define POISSON_MIN_PULSE	(500)	/* cycles, the ISR draws the next gap within it */
+#define POISSON_MIN_GAP	(64)	/* cycles, mean gap */
+#define POISSON_MEAN_MAX	(3072)	/* timer1 ticks, 16 means fit behind the pulse */
+#define POISSON_PULSE_MAX	(0x4000)	/* timer1 ticks */
+#define POISSON_BINS	(128)	/* table entries + the tail */
+#define POISSON_TAIL	(1242)	/* ln(128) means, 8.8 fixed point */
+#define POISSON_CAP		(4096)	/* 16 means, 8.8, longer draws are cut */
+#define SHOT_MIN		(32)	/* cycles per phase, the next match is set up in time */
+#define SHOT_LEAD		(256)	/* cycles from the trigger or command to the first edge */
+#define SHOT_SEG		(0x8000)	/* cycles, hold segment of a long phase */
+#define SHOT_SAFE		(8192)	/* cycles, longer than any ISR, interrupts stay on when the next edge is as far */
+#define SHOT_SET		((1 << COM1B1) | (1 << COM1B0))	/* normal mode, set OC1B on match */
+#define SHOT_CLR		(1 << COM1B1)					/* normal mode, clear OC1B on match */
+#define DELAY_FIFO		(16)	/* power of 2, one slot stays free */
+#define DELAY_MIN		(256)	/* cycles, the capture ISR arms the edge in time */
+#define DELAY_MAX		(32512)	/* timer1 ticks, well inside the signed 16 bit compare */
+#define DELAY_NEAR		(16)	/* ticks, closer edges are forced */
+#define HOP_ENTRIES		(8)		/* power of 2, 40 bytes of SRAM */
+#define HOP_MIN			(200)	/* ticks per phase, the ISR fits a period */
+#define HOP_MAX			(32767)	/* ticks per phase, a period fits 16 bits */
+#define JITTER_BINS		(6)		/* even, deviations -BINS/2 to BINS/2 - 1 widths, the outer bins open */
+#define JITTER_MAX_WIDTH	(13)	/* the outer bins stay inside the 16 bit deviation */
+#define JITTER_MIN_PHASE	(100)	/* cycles, the capture ISR takes both edges in time */
+#define STEP_KA			(3051757812UL)	/* (F_CPU / 256)^2 / 2, K = STEP_KA / a << 2 * prescaller shift */
+
+#define OUT_SET()		do{ PORTB = 0xFF; }while(0)
+#define OUT_CLR()		do{ PORTB = 0; }while(0)
+#define OUT_TGL()		do{ PINB = 0xFF; }while(0)
+
+#define TMR_START()	do{ TCCR0B = (1 << CS00); }while(0) /* Start timer0 with no prescaller */
+#define TMR_STOP()		do{ TCCR0B = 0; }while(0)
+#define TMR_SET_INT()	do{ TIMSK |= (1 << OCIE0A); }while(0)
+#define TMR_CLR_INT()	do{ TIMSK &= ~(1 << OCIE0A); }while(0)
+
+#if HAVE_REPLY
+/* Send one queued reply byte, only used where the timer absorbs the extra cycles */
+#define TX_POLL()		do{ if(txLeft && (UCSRA & (1 << UDRE))){ txNext(); } }while(0)
+#else
+#define TX_POLL()		do{ }while(0)
+#endif
+
+#if FEATURE_STATUS
+/* Watchdog interrupt once a second for the uptime, off (the watchdog stops) in
+ * the loops whose timing has no room for it */
+#define UPTIME_RUN()	do{ WDTCSR = (1 << WDIE) | (1 << WDP2) | (1 << WDP1); }while(0)
+#define UPTIME_HOLD()	do{ WDTCSR = (1 << WDP2) | (1 << WDP1); }while(0)
+#else
+#define UPTIME_RUN()	do{ }while(0)
+#define UPTIME_HOLD()	do{ }while(0)
+#endif
+
+#define EXT_MIN_TICKS	(32)	/* timer1 compare ISR must finish before the next match */
+#define EXT_SEG_LEN		(0x8000)
+#define EXT_HOLD_LOW	((1 << COM1A1))					/* clear OC1A on match */
+#define EXT_HOLD_HIGH	((1 << COM1A1) | (1 << COM1A0))	/* set OC1A on match */
+#define EXT_START()		do{ TCCR1B = (1 << WGM12) | (1 << CS12) | (1 << CS11) | (1 << CS10); }while(0) /* CTC, clock on T1 rising edge */
+#define EXT_STOP()		do{ TCCR1B = 0; TCCR1A = 0; TIMSK &= ~(1 << OCIE1A); }while(0)
+
+enum{
+	CMD_SET_PAUSE = 0,
+	CMD_SET_PULSE = 1,
+	CMD_STORE = 2, 		/* Save in EEPROM */
+	CMD_PRESET_STORE = 3,
+	CMD_PRESET_RECALL = 4,
+	CMD_PRESET_BOOT = 5,
+	CMD_STOP = 6,
+	CMD_RUN = 7,
+	CMD_TIMEBASE = 8,
+	CMD_EXT_DIVIDE = 9,
+	CMD_MEASURE = 10,
+	CMD_MEASURE_REPORT = 11,
+	CMD_STATUS = 12,
+	CMD_LINK_RATE = 13,
+	CMD_PRBS = 14,
+	CMD_PRBS_SEED = 15,
+	CMD_CODE_DATA = 16,
+	CMD_CODE = 17,
+	CMD_CODE_RATE = 18,
+	CMD_PWM_FRAME = 19,
+	CMD_PWM = 20,
+	CMD_STEP_RATE = 21,
+	CMD_STEP_ACCEL = 22,
+	CMD_STEP = 23,
+	CMD_QUAD = 24,
+	CMD_QUAD_INDEX = 25,
+	CMD_PLL = 26,
+	CMD_BINARY = 27,
+	CMD_PDM = 28,
+	CMD_SPREAD = 29,
+	CMD_POISSON = 30,
+	CMD_SHOT_LEN = 31,
+	CMD_SHOT = 32,
+	CMD_DELAY = 33,
+	CMD_HOP_LEN = 34,
+	CMD_HOP = 35,
+	CMD_JITTER = 36,
+	CMD_JITTER_REPORT = 37,
+	CMD_UNKNOWN
+};
+
+enum{
+	SHOT_NOW = 0,
+	SHOT_RISE,
+	SHOT_FALL,
+	SHOT_IDLE,				/* fired, waits for the next 20 */
+};
+
+enum{
+	HOP_PAUSE = 0,
+	HOP_PULSE,
+	HOP_DWELL,
+	HOP_UNKNOWN
+};
+
+enum{
+	SPREAD_TRIANGLE = 0,
+	SPREAD_LFSR,
+};
+
+enum{
+	TX_STATUS = 0,
+	TX_MEASURE = 1,
+	TX_STEP = 2,
+	TX_SHOT = 3,
+	TX_DELAY = 4,
+	TX_JITTER = 5,
+};
+
+enum{
+	LINK_9600 = 0,
+	LINK_38400,
+	LINK_250K,
+	LINK_500K,
+	LINK_UNKNOWN
+};
+
+enum{
+	PRBS_7 = 0,
+	PRBS_15,
+	PRBS_23,
+	PRBS_31,
+	PRBS_UNKNOWN
+};
+
+enum{
+	CODE_NRZ = 0,
+	CODE_NRZI,
+	CODE_MANCHESTER,
+	CODE_UART,
+	CODE_UNKNOWN
+};
+
+#define CODE_PARITY_EVEN	(1)
+#define CODE_PARITY_ODD		(2)
+#define CODE_TWO_STOP		(1 << 2)
+
+enum{
+	TIMEBASE_INTERNAL = 0,
+	TIMEBASE_EXTERNAL = 1,
+	TIMEBASE_UNKNOWN
+};
+
+enum{
+	STOP_LOW = 0,
+	STOP_HIGH = 1,
+	STOP_HIZ = 2,
+	STOP_UNKNOWN,
+	OUT_RUNNING = 0xFF
+};
+
+enum{
+	MODE_TOGGLE = 0,		/* period below 1,5us, unrolled toggle loops */
+	MODE_COUNT_SHORT,		/* pause and pulse both within one timer0 period */
+	MODE_COUNT_LONG_HIGH,	/* only pulse longer than one timer0 period */
+	MODE_COUNT_LONG_LOW,	/* only pause longer than one timer0 period */
+	MODE_COUNT_LONG,		/* both longer than one timer0 period */
+	MODE_EXT_CLOCK,			/* timer1 on T1, counts hold reference ticks */
+	MODE_PRBS,				/* lowRem poly, highRem prescaller, lowCount OCR0A, highCount seed */
+	MODE_CODE,				/* highRem prescaller, lowCount OCR0A, rest in code* */
+	MODE_PWM,				/* lowRem timer1 shift, highRem CS1 bits, lowCount top, rest in pwm* */
+	MODE_STEP,				/* lowRem direction, lowCount steps left to start, rest in step* */
+	MODE_QUAD,				/* lowRem direction, highRem CS1 bits, lowCount ticks per count */
+	MODE_PLL,				/* lowRem M, highRem N, lowCount CS1 bits */
+	MODE_BINARY,			/* lowRem delay rounds, highRem skips, lowCount k */
+	MODE_PDM,				/* lowCount level */
+	MODE_SPREAD,			/* lowRem profile, highRem step, lowCount pause, highCount pulse */
+	MODE_POISSON,			/* highRem CS1 bits, lowCount mean gap, highCount pulse, ticks */
+	MODE_SHOT,				/* lowRem source, rest in shot* */
+	MODE_DELAY,				/* highRem CS1 bits, lowCount delay in ticks */
+	MODE_HOP,				/* lowRem entries, highRem CS1 bits, table in hop* */
+	MODE_UNKNOWN
+};
+
+/* Precomputed timing, so no divisions are needed when a waveform is started */
+typedef struct{
+	uint8_t mode;
+	uint8_t lowRem;			/* timer0 ticks after full periods, or toggle period index */
+	uint8_t highRem;
+	uint32_t lowCount;		/* full timer0 periods */
+	uint32_t highCount;
+}plan_t;
+
+/* Self-test result, times in CPU cycles */
+typedef struct{
+	uint8_t count;			/* periods measured so far */
+	uint32_t minPeriod;
+	uint32_t maxPeriod;
+	uint32_t sumPeriod;
+	uint32_t sumHigh;
+}measure_t;
+
+typedef struct{
+	uint8_t mode;
+	uint8_t outState;
+	uint32_t lowCycles;		/* effective, after quantization */
+	uint32_t highCycles;
+	uint8_t rxOverruns;
+	uint8_t rxFrameErrors;
+	uint32_t uptime;		/* seconds */
+}status_t;
+
+/* Every reply payload, txFrame holds the largest behind the header */
+typedef union{
+#if FEATURE_SELFTEST
+	measure_t measure;
+#endif
+#if FEATURE_STATUS
+	status_t status;
+#endif
+#if FEATURE_JITTER
+	uint16_t jitter[JITTER_BINS];
+#endif
+	uint32_t count;			/* TX_STEP, TX_SHOT, TX_DELAY */
+}reply_t;
+
+
+/* PWM edge schedule of one frame */
+typedef struct{
+	uint8_t count;			/* distinct edge times */
+	uint8_t start;			/* PORTB at the frame start, the channels with a width */
+	uint16_t time[PWM_CHANNELS];	/* OCR1B of each edge, ascending */
+	uint8_t level[PWM_CHANNELS];	/* PORTB from that edge on */
+}pwm_t;
+
+/* Frequency hopping table entry, timer1 ticks */
+typedef struct{
+	uint16_t pause;
+	uint16_t pulse;
+	uint8_t dwell;			/* periods, 0 for 256 */
+}hop_t;
+
+/* Preset log entry */
+typedef struct{
+	uint8_t seq;
+	uint8_t slot;
+	plan_t plan;
+	uint8_t crc;
+}record_t;
+
+/* 1kHz, 50% duty, used when the boot slot does not hold a valid preset */
+static const plan_t defaultPlan PROGMEM = {
+	MODE_COUNT_LONG, 0, 0,
+	(uint32_t)10000 / TMR0_MAX_COUNT,
+	(uint32_t)10000 / TMR0_MAX_COUNT,
+};
+
+#if FEATURE_PRESETS
+record_t EEMEM presetLog[LOG_SIZE];
+uint8_t EEMEM bootSlot;
+
+uint8_t logPos[PRESET_COUNT];	/* newest record of each slot, or LOG_NONE */
+uint8_t logSeq;				/* sequence number for the next record */
+uint8_t logHead;			/* where to look for the next free record */
+uint8_t logScanPos;			/* next record to scan, LOG_SIZE when done, LOG_NONE before */
+volatile uint8_t bootSlotRam;
+volatile uint8_t eeJobs;	/* EE_JOB_BOOT and the bit of the slot waiting to be stored */
+record_t eeRecord;			/* record being written, or queued with its plan */
+uint8_t eeSlot;				/* its slot, LOG_NONE while idle or writing bootSlot */
+uint8_t eePos;
+uint8_t eeAddr;
+const uint8_t *eeSrc;
+uint8_t eeLeft;
+uint8_t eeRecall;			/* slot to recall once the byte being written is done, or LOG_NONE */
+#endif
+
+volatile uint8_t rx_buf[RX_SIZE];
+volatile uint8_t rx_index;
+uint8_t rxLen;				/* frame length, 0 before the length byte, or RX_HUNT */
+uint8_t rxCrc;
+bool rxEsc;
+volatile uint32_t pauseLen;	/* pause duration in us */
+volatile uint32_t pulseLen; /* pulse duration in us */
+volatile bool modeContinueFlag;
+volatile uint32_t tmr0CycleCount;
+volatile plan_t plan;
+volatile uint8_t outState;	/* OUT_RUNNING or one of the STOP_ states */
+volatile uint8_t timebase;
+#if FEATURE_EXT_CLOCK
+volatile bool extHigh;		/* OC1A level during the running phase */
+volatile uint16_t extLeft;	/* EXT_SEG_LEN segments left in the running phase */
+#endif
+#if FEATURE_SELFTEST
+volatile measure_t measure;
+volatile uint8_t measWindow;
+volatile uint16_t measOvf;	/* timer1 high word */
+uint32_t measRise;			/* timestamp of the last rising edge */
+bool measArmed;				/* measRise is valid */
+#endif
+#if FEATURE_JITTER
+uint16_t jitterHist[JITTER_BINS];
+#define JITTER_WIDTH	GPIOR0	/* bin width shift, an I/O register spares the SRAM */
+#endif
+#if FEATURE_STATUS
+volatile bool statusDue;	/* a new plan was made, send a status frame */
+volatile uint8_t rxOverruns;
+volatile uint8_t rxFrameErrors;
+volatile uint32_t uptime;
+#endif
+#if FEATURE_FAST_LINK
+uint8_t linkRate;
+#endif
+#if FEATURE_LINECODE
+uint8_t codeData[CODE_SIZE];
+uint8_t codeChips[CODE_CHIPS];
+uint8_t codeBytes;			/* chip bytes per frame */
+uint8_t codeBit;			/* chips encoded so far */
+uint8_t codeIdle;			/* COM0A bits holding the idle level */
+uint8_t codeRepeat;
+uint8_t codeIrqOff;			/* chips too short for an ISR to pass unnoticed */
+uint16_t codeGap;			/* chips */
+uint32_t codePeriod = CODE_MIN_CHIP;	/* bit period in CPU cycles */
+#endif
+#if FEATURE_PWM
+pwm_t pwmBuf[2];
+volatile uint8_t pwmCur;	/* buffer the ISR plays */
+volatile bool pwmSwap;		/* the other buffer is newer, take it at the frame start */
+uint8_t pwmEdge;			/* next entry of the schedule, count for the frame end */
+uint8_t pwmNear;			/* PWM_NEAR in timer1 steps */
+uint8_t pwmEarly;			/* PWM_EARLY in timer1 steps */
+#endif
+#if FEATURE_STEPPER
+uint32_t stepRate = 1000;	/* steps/s */
+uint32_t stepAccel = 1000;	/* steps/s^2 */
+volatile uint32_t stepLeft;	/* steps not yet made, counted by the ISR */
+volatile uint16_t stepNext;	/* interval after the next step, timer1 ticks */
+volatile bool stepNeed;		/* the ISR took stepNext */
+uint32_t stepN;				/* ramp step of stepC */
+uint32_t stepSq;			/* stepC^2 */
+uint32_t stepU;				/* (2 stepC - 1) stepN */
+int32_t stepD;				/* K - stepC^2 stepN, >= 0 */
+uint16_t stepC;				/* floor(sqrt(K / stepN)) */
+uint16_t stepC1;			/* stepC at stepN 1 and 2, where it moves too far */
+uint16_t stepC2;			/* for the recurrence */
+uint16_t stepMin;			/* interval at the top rate */
+#endif
+#if FEATURE_QUADRATURE
+volatile bool quadDirty;	/* plan holds a new rate or direction */
+uint8_t quadDir;			/* direction the outputs run in */
+uint8_t quadB;				/* B level seen by the ISR */
+uint16_t quadCycles;		/* A/B cycles (4 counts) per index, 0 off */
+uint16_t quadPos;
+#endif
+#if FEATURE_PLL
+volatile uint16_t pllQ;		/* half period in timer1 ticks, 0 before the first span */
+volatile uint16_t pllR;		/* span - 2M Q, spread over the half periods */
+volatile uint16_t pllErr;	/* Bresenham sum of pllR */
+volatile uint16_t pllNext;	/* time of the edge in OCR1B */
+uint16_t pll2M;				/* half periods per span */
+uint8_t pllN;				/* input periods per span */
+uint8_t pllCount;			/* input periods in pllSpan */
+uint16_t pllLast;			/* ICR1 of the last input edge */
+uint32_t pllSpan;
+volatile uint32_t pllSpanDone;	/* last full span, for main() */
+volatile bool pllSpanReady;
+#endif
+#if FEATURE_SPREAD
+uint16_t spreadMax;			/* largest period offset, cycles */
+uint16_t spreadPause;		/* nominal OCR1B */
+uint16_t spreadTop;			/* nominal OCR1A */
+int16_t spreadP;			/* triangle offset of the next period */
+int16_t spreadDir;			/* triangle step, signed */
+uint16_t spreadLfsr;
+uint16_t spreadLast;		/* LFSR displacement of the last period end */
+#endif
+#if FEATURE_DOUBLE_PULSE
+uint32_t shotLen[3] = { 2000, 200, 200 };	/* first pulse, gap, second pulse, cycles */
+uint32_t shotCount;			/* shots made, the TX_SHOT payload */
+#endif
+#if FEATURE_DELAY
+uint16_t delayFifo[DELAY_FIFO];	/* OCR1B of the edges in flight */
+volatile uint8_t delayHead;
+volatile uint8_t delayTail;
+uint8_t delayLevel;			/* OC1B after the last edge set up */
+bool delayArmed;			/* OCR1B holds an edge from the queue */
+uint16_t delayTicks;
+uint32_t delayOverflows;	/* the TX_DELAY payload */
+volatile bool delayReport;
+#endif
+#if FEATURE_HOP
+hop_t hopTable[HOP_ENTRIES];
+uint8_t hopIndex;			/* entry in hopPause, hopTop and hopDwell */
+uint8_t hopLeft;			/* periods of the running entry yet to start */
+uint16_t hopPause;			/* next OCR1B */
+uint16_t hopTop;			/* next OCR1A */
+uint8_t hopDwell;
+#endif
+#if FEATURE_POISSON
+uint16_t poissonLfsr;
+uint16_t poissonMean;		/* mean gap, timer1 ticks */
+uint16_t poissonPulse;		/* OCR1B */
+uint16_t poissonMax;		/* longest gap, the period fits 16 bits */
+#endif
+#if HAVE_REPLY
+volatile uint8_t txFrame[4 + sizeof(reply_t)];	/* sync, type, length, payload, crc8 */
+volatile uint8_t *volatile txPtr;
+volatile uint8_t txLeft;
+#endif
+
+
+/* Timer0 periods and remainder of one phase */
+static void planPhase(uint32_t len, volatile uint32_t *count, volatile uint8_t *rem){
+	uint32_t n;
+
+	len *= 2;
+	n = len / TMR0_MAX_COUNT;
+	*count = n;
+	*rem = (uint8_t)(len - n * TMR0_MAX_COUNT);
+}
+
+#if FEATURE_EXT_CLOCK
+/* Equal phases the compare hardware toggles on its own, any length from 1 */
+static bool extPlain(uint32_t low, uint32_t high){
+	return (low == high) && (low != 0) && (low <= 0x10000);
+}
+
+/* A phase the compare ISR can not keep up with is lengthened here, so the
+ * plan and the status frame hold the one played */
+static void extPlan(uint32_t low, uint32_t high){
+	if(!extPlain(low, high)){
+		low = (low < EXT_MIN_TICKS) ? EXT_MIN_TICKS : low;
+		high = (high < EXT_MIN_TICKS) ? EXT_MIN_TICKS : high;
+	}
+	plan.mode = MODE_EXT_CLOCK;
+	plan.lowCount = low;
+	plan.highCount = high;
+}
+#endif
+
+/* Called from the RX ISR as soon as a command changes the timing, so the main
+ * loop only has to pick the engine. Only the phases given are divided, the
+ * other one is kept from the current count plan. */
+static void makePlan(uint8_t phases){
+	uint32_t pause = pauseLen;
+	uint32_t pulse = pulseLen;
+
+#if FEATURE_STATUS
+	statusDue = true;
+#endif
+
+#if FEATURE_EXT_CLOCK
+	if(timebase == TIMEBASE_EXTERNAL){
+		extPlan(pause, pulse);
+		return;
+	}
+#endif
+
+#if FEATURE_TOGGLE
+	if((pause < 15) && (pulse < 15) && ((pause + pulse) < 15)){
+		plan.mode = MODE_TOGGLE;
+		plan.lowRem = (uint8_t)(pause + pulse)>>1;
+		plan.highRem = plan.lowRem;
+		plan.lowCount = 0;
+		plan.highCount = 0;
+		return;
+	}
+#endif
+
+	if((plan.mode < MODE_COUNT_SHORT) || (plan.mode > MODE_COUNT_LONG)){
+		/* the old plan holds no timer0 counts */
+		phases = PHASE_LOW | PHASE_HIGH;
+	}
+	if(phases & PHASE_LOW){
+		planPhase(pause, &plan.lowCount, &plan.lowRem);
+	}
+	if(phases & PHASE_HIGH){
+		planPhase(pulse, &plan.highCount, &plan.highRem);
+	}
+
+	if((plan.lowCount == 0) && (plan.highCount == 0)){
+		plan.mode = MODE_COUNT_SHORT;
+	}else if(plan.lowCount == 0){
+		plan.mode = MODE_COUNT_LONG_HIGH;
+	}else if(plan.highCount == 0){
+		plan.mode = MODE_COUNT_LONG_LOW;
+	}else{
+		plan.mode = MODE_COUNT_LONG;
+	}
+}
+
+/* Inverse of makePlan, so single parameter changes work after a recall */
+static uint32_t planLen(uint32_t count, uint8_t rem){
+	return (count * TMR0_MAX_COUNT + rem) >> 1;
+}
+
+#if FEATURE_PRESETS
+/* Presets may come from a variant with other engines built in */
+static bool modeBuilt(uint8_t mode){
+#if !FEATURE_TOGGLE
+	if(mode == MODE_TOGGLE){
+		return false;
+	}
+#endif
+#if !FEATURE_EXT_CLOCK
+	if(mode == MODE_EXT_CLOCK){
+		return false;
+	}
+#endif
+#if !FEATURE_PRBS
+	if(mode == MODE_PRBS){
+		return false;
+	}
+#endif
+#if !FEATURE_PLL
+	if(mode == MODE_PLL){
+		return false;
+	}
+#endif
+#if !FEATURE_BINARY
+	if(mode == MODE_BINARY){
+		return false;
+	}
+#endif
+#if !FEATURE_PDM
+	if(mode == MODE_PDM){
+		return false;
+	}
+#endif
+#if !FEATURE_POISSON
+	if(mode == MODE_POISSON){
+		return false;
+	}
+#endif
+#if !FEATURE_DELAY
+	if(mode == MODE_DELAY){
+		return false;
+	}
+#endif
+	if((mode == MODE_CODE) || (mode == MODE_PWM) || (mode == MODE_STEP) || (mode == MODE_QUAD)
+		|| (mode == MODE_SPREAD) || (mode == MODE_SHOT) || (mode == MODE_HOP)){
+		return false;	/* the payload, widths, move, spread or shot are not stored */
+	}
+	return mode < MODE_UNKNOWN;
+}
+
+static uint8_t recordCrc(const record_t *r){
+	const uint8_t *data = (const uint8_t *)r;
+	uint8_t crc = PRESET_VERSION;
+	uint8_t i;
+
+	for(i = 0; i < offsetof(record_t, crc); i++){
+		crc = _crc8_ccitt_update(crc, data[i]);
+	}
+	return crc;
+}
+#endif
+
+/* Set pauseLen, pulseLen and timebase to match a plan loaded from elsewhere */
+static void applyPlan( void ){
+	timebase = TIMEBASE_INTERNAL;
+
+	if(plan.mode == MODE_TOGGLE){
+		pauseLen = plan.lowRem;
+		pulseLen = plan.lowRem;
+	}else if(plan.mode == MODE_EXT_CLOCK){
+		timebase = TIMEBASE_EXTERNAL;
+#if FEATURE_EXT_CLOCK
+		extPlan(plan.lowCount, plan.highCount);	/* a preset from before may hold shorter phases */
+#endif
+		pauseLen = plan.lowCount;
+		pulseLen = plan.highCount;
+	}else if(plan.mode <= MODE_COUNT_LONG){
+		pauseLen = planLen(plan.lowCount, plan.lowRem);
+		pulseLen = planLen(plan.highCount, plan.highRem);
+	}
+}
+
+/* Break out of the running engine loop, a recall still waiting for the EEPROM
+ * is dropped */
+static void restartEngine( void ){
+	modeContinueFlag = false;
+	tmr0CycleCount = 0xFFFFFFFE;
+#if FEATURE_PRESETS
+	eeRecall = LOG_NONE;
+#endif
+}
+
+#if FEATURE_PRESETS
+/* Returns false and keeps the current plan if the slot is empty or corrupted */
+static bool loadPlan(uint8_t slot){
+	record_t record;
+
+	if(logPos[slot] == LOG_NONE){
+		return false;
+	}
+
+	eeprom_read_block(&record, &presetLog[logPos[slot]], sizeof(record_t));
+
+	if((record.crc != recordCrc(&record)) || !modeBuilt(record.plan.mode)){
+		return false;
+	}
+
+	plan = record.plan;
+	applyPlan();
+	return true;
+}
+
+/* Newest valid record of one slot, LOG_NONE if there is none. Only the slot
+ * and seq bytes of the others are read, and only the newest copy is checked
+ * unless its crc fails, ~1,5k cycles against ~8k for the whole scan, so the
+ * boot plan does not wait for it. Sequence numbers are only compared between
+ * copies of one slot, which are never more than LOG_SIZE apart. */
+static uint8_t logFind(uint8_t slot){
+	record_t record;
+	uint8_t pos, seq;
+	uint8_t best, bestSeq = 0, below = 0;
+	bool limit = false;
+
+	for(;;){
+		best = LOG_NONE;
+		for(pos = 0; pos < LOG_SIZE; pos++){
+			if(eeprom_read_byte(&presetLog[pos].slot) != slot){
+				continue;
+			}
+			seq = eeprom_read_byte(&presetLog[pos].seq);
+			if(limit && ((int8_t)(seq - below) >= 0)){
+				continue;
+			}
+			if((best == LOG_NONE) || ((int8_t)(seq - bestSeq) > 0)){
+				best = pos;
+				bestSeq = seq;
+			}
+		}
+		if(best == LOG_NONE){
+			return LOG_NONE;
+		}
+		eeprom_read_block(&record, &presetLog[best], sizeof(record_t));
+		if(record.crc == recordCrc(&record)){
+			return best;
+		}
+		below = bestSeq;	/* torn, try the copy before it */
+		limit = true;
+	}
+}
+
+/* Starts the scan for the newest record of every slot, which the EE_READY
+ * interrupt does one record at a time before any store or recall. Only the
+ * first preset command after a reset waits for it, not the boot plan. */
+static void logScan( void ){
+	if(logScanPos == LOG_NONE){
+		memset(logPos, LOG_NONE, sizeof(logPos));
+		logHead = LOG_NONE;		/* the newest record until the scan ends */
+		logScanPos = 0;
+		EECR |= (1 << EERIE);
+	}
+}
+
+/* One record of the scan, ~900 cycles */
+static void logScanNext( void ){
+	record_t record;
+	uint8_t pos = logScanPos++;
+	uint8_t *last;
+
+	eeprom_read_block(&record, &presetLog[pos], sizeof(record_t));
+
+	if((record.crc == recordCrc(&record)) && (record.slot < PRESET_COUNT)){
+		last = &logPos[record.slot];
+		if((*last == LOG_NONE) ||
+				((int8_t)(record.seq - eeprom_read_byte(&presetLog[*last].seq)) > 0)){
+			*last = pos;
+		}
+
+		/* Only a hint for wear spreading, a wrong guess costs nothing */
+		if((logHead == LOG_NONE) || ((int8_t)(record.seq - logSeq) > 0)){
+			logHead = pos;
+			logSeq = record.seq;
+		}
+	}
+
+	if(logScanPos == LOG_SIZE){
+		logSeq++;
+		logHead = (logHead < LOG_SIZE - 1) ? logHead + 1 : 0;
+	}
+}
+
+static bool logInUse(uint8_t pos){
+	uint8_t slot;
+
+	for(slot = 0; slot < PRESET_COUNT; slot++){
+		if(logPos[slot] == pos){
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Set up the next queued write, called from the EE_READY ISR */
+static bool eeNextJob( void ){
+	uint8_t slot;
+
+	if(eeJobs & EE_JOB_BOOT){
+		eeJobs &= ~EE_JOB_BOOT;
+		eeSlot = LOG_NONE;
+		eeAddr = (uint8_t)(uint16_t)&bootSlot;
+		eeSrc = (const uint8_t *)&bootSlotRam;
+		eeLeft = 1;
+		return true;
+	}
+
+	for(slot = 0; slot < PRESET_COUNT; slot++){
+		if(eeJobs & (1 << slot)){
+			break;
+		}
+	}
+	if(slot == PRESET_COUNT){
+		return false;
+	}
+	eeJobs &= ~(1 << slot);
+
+	/* Never overwrite a live record, not even the one being replaced */
+	while(logInUse(logHead)){
+		if(++logHead == LOG_SIZE){
+			logHead = 0;
+		}
+	}
+
+	if(logPos[slot] != LOG_NONE){
+		uint8_t last = eeprom_read_byte(&presetLog[logPos[slot]].seq);
+
+		if((int8_t)(logSeq - last) <= 0){
+			logSeq = last + 1;
+		}
+	}
+
+	eeRecord.seq = logSeq++;	/* plan and slot are set by storePlan */
+	eeRecord.crc = recordCrc(&eeRecord);
+
+	eeSlot = slot;
+	eePos = logHead;
+	eeAddr = (uint8_t)(uint16_t)&presetLog[logHead];
+	eeSrc = (const uint8_t *)&eeRecord;
+	eeLeft = sizeof(record_t);
+	return true;
+}
+
+/* Scans the log, then writes one byte per interrupt, bytes that already match
+ * are skipped */
+ISR (EE_READY_vect)
+{
+	if(logScanPos < LOG_SIZE){
+		logScanNext();
+		return;
+	}
+
+	if(eeRecall != LOG_NONE){
+		if(loadPlan(eeRecall)){
+			restartEngine();
+		}
+		eeRecall = LOG_NONE;
+	}
+
+	if(eeLeft == 0){
+		if(eeSlot != LOG_NONE){
+			/* crc is written last, so the new record only counts once complete */
+			logPos[eeSlot] = eePos;
+			eeSlot = LOG_NONE;
+			if(++logHead == LOG_SIZE){
+				logHead = 0;
+			}
+		}
+		if(!eeNextJob()){
+			EECR &= ~(1 << EERIE);
+			return;
+		}
+	}
+
+	EEAR = eeAddr++;
+	EECR |= (1 << EERE);
+	if(EEDR != *eeSrc){
+		EEDR = *eeSrc;
+		EECR |= (1 << EEMPE);
+		EECR |= (1 << EEPE);
+	}
+	eeSrc++;
+	eeLeft--;
+}
+
+/* Takes the plan now, the record is written in the background. Returns false
+ * and drops the store while another one is queued or being written (~50ms),
+ * eeRecord holds that one. */
+static bool storePlan(uint8_t slot){
+	if((eeJobs & ~EE_JOB_BOOT) || (eeSlot != LOG_NONE)){
+		return false;
+	}
+	eeRecord.slot = slot;
+	eeRecord.plan = plan;
+	eeJobs |= (1 << slot);
+	EECR |= (1 << EERIE);
+	logScan();
+	return true;
+}
+
+static void storeBootSlot(uint8_t slot){
+	bootSlotRam = slot;
+	eeJobs |= EE_JOB_BOOT;
+	EECR |= (1 << EERIE);
+}
+
+/* Reading the record waits for a byte being written, up to 3,4ms, which the
+ * RX interrupt must not. Then the recall is left to the EE_READY interrupt,
+ * due once that byte is done, EERIE is set all through a write. The first
+ * recall after a reset also waits there for the scan. */
+static void recallPlan(uint8_t slot){
+	if((EECR & (1 << EEPE)) || (logScanPos != LOG_SIZE)){
+		eeRecall = slot;
+		logScan();
+		return;
+	}
+	if(loadPlan(slot)){
+		restartEngine();
+	}
+}
+#endif
+
+
+/* Argument bytes following each command byte */
+static const uint8_t cmdArgLen[CMD_UNKNOWN] PROGMEM = {
+	4,	/* CMD_SET_PAUSE */
+	4,	/* CMD_SET_PULSE */
+	0,	/* CMD_STORE */
+	1,	/* CMD_PRESET_STORE */
+	1,	/* CMD_PRESET_RECALL */
+	1,	/* CMD_PRESET_BOOT */
+	1,	/* CMD_STOP */
+	0,	/* CMD_RUN */
+	1,	/* CMD_TIMEBASE */
+	4,	/* CMD_EXT_DIVIDE */
+	1,	/* CMD_MEASURE */
+	0,	/* CMD_MEASURE_REPORT */
+	0,	/* CMD_STATUS */
+	1,	/* CMD_LINK_RATE */
+	4,	/* CMD_PRBS */
+	4,	/* CMD_PRBS_SEED */
+	4,	/* CMD_CODE_DATA */
+	4,	/* CMD_CODE */
+	4,	/* CMD_CODE_RATE */
+	4,	/* CMD_PWM_FRAME */
+	4,	/* CMD_PWM */
+	4,	/* CMD_STEP_RATE */
+	4,	/* CMD_STEP_ACCEL */
+	4,	/* CMD_STEP */
+	4,	/* CMD_QUAD */
+	4,	/* CMD_QUAD_INDEX */
+	4,	/* CMD_PLL */
+	4,	/* CMD_BINARY */
+	4,	/* CMD_PDM */
+	4,	/* CMD_SPREAD */
+	4,	/* CMD_POISSON */
+	4,	/* CMD_SHOT_LEN */
+	1,	/* CMD_SHOT */
+	4,	/* CMD_DELAY */
+	4,	/* CMD_HOP_LEN */
+	2,	/* CMD_HOP */
+	1,	/* CMD_JITTER */
+	0,	/* CMD_JITTER_REPORT */
+};
+
+/* UART divider for each link rate, U2X is always on */
+static const uint16_t linkUbrr[LINK_UNKNOWN] PROGMEM = {
+	UBRR_U2X(9600),
+	UBRR_U2X(38400),
+	UBRR_U2X(250000),
+	UBRR_U2X(500000),
+};
+
+static void linkSet(uint8_t rate){
+	uint16_t ubrr = pgm_read_word(&linkUbrr[rate]);
+
+	UBRRH = (uint8_t)(ubrr >> 8);
+	UBRRL = (uint8_t)ubrr;
+#if FEATURE_FAST_LINK
+	linkRate = rate;
+#endif
+}
+
+#if FEATURE_FAST_LINK
+/* After a framing error: only a break from the bridge holds RXD low for longer
+ * than a frame. A garbage byte or noise lets it go high within 9 bits, so the
+ * link keeps its rate, which the bridge has no way to learn about. At least 6
+ * cycles per pass, 16 (UBRR + 1) passes outlast the 80 (UBRR + 1) cycles of a
+ * frame; a break blocks the RX ISR for that once, 0,3ms at 38400. */
+static bool linkBreakSeen( void ){
+	uint16_t n = (pgm_read_word(&linkUbrr[linkRate]) + 1) * 16;
+
+	do{
+		if(PIND & (1 << PD0)){
+			return false;
+		}
+	}while(--n);
+	return true;
+}
+
+/* Ack at the old rate and switch once the ack is out */
+static void linkAck(uint8_t rate){
+#if HAVE_REPLY
+	txLeft = 0;				/* a reply cut by the switch could not be parsed */
+#endif
+	waitTxReady();
+	UCSRA = (1 << U2X) | (1 << TXC);	/* clear TXC */
+	UDR = LINK_ACK;
+	while((UCSRA & (1 << TXC)) == 0);
+	linkSet(rate);
+}
+#endif
+
+#if HAVE_REPLY
+/* Queue a reply, sent byte by byte from TX_POLL(). Framed like the commands:
+ * LINK_SYNC, type, length, payload and the crc8 of type to payload. Called
+ * from the main loop and the RX ISR, so the test and the fill are atomic. */
+static void txStart(uint8_t type, const volatile void *data, uint8_t len){
+	uint8_t crc = 0;
+	uint8_t i;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		if(txLeft){
+			return;
+		}
+		txFrame[0] = LINK_SYNC;
+		txFrame[1] = type;
+		txFrame[2] = len;
+		memcpy((void *)&txFrame[3], (const void *)data, len);
+		for(i = 1; i < len + 3; i++){
+			crc = _crc8_ccitt_update(crc, txFrame[i]);
+		}
+		txFrame[len + 3] = crc;
+		txPtr = txFrame;
+		txLeft = len + 4;
+	}
+}
+
+/* One reply byte. LINK_SYNC and LINK_ESC after the sync go out as LINK_ESC and
+ * the byte xor 0x20, which is left in its place for the next call. The RX ISR
+ * may cut or start a reply between the test in TX_POLL() and here. */
+static void txNext( void ){
+	uint8_t data;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		if(txLeft){
+			data = *txPtr;
+			if((txPtr != txFrame) && ((data == LINK_SYNC) || (data == LINK_ESC))){
+				*txPtr = data ^ 0x20;
+				data = LINK_ESC;
+			}else{
+				txPtr++;
+				txLeft--;
+			}
+			UDR = data;
+		}
+	}
+}
+
+/* txStart for a payload object, which must be one of reply_t */
+#define txReply(type, obj)	do{ \
+		_Static_assert(sizeof(obj) <= sizeof(reply_t), "reply_t lacks this reply"); \
+		txStart((type), &(obj), sizeof(obj)); \
+	}while(0)
+#endif
+
+#if FEATURE_STATUS || FEATURE_JITTER
+static uint32_t effectiveCycles(uint32_t count, uint8_t rem){
+	if(plan.mode == MODE_TOGGLE){
+		return rem ? (uint32_t)rem * 2 : 1;
+	}
+	if(plan.mode == MODE_EXT_CLOCK){
+		return count;
+	}
+	return count * TMR0_MAX_COUNT + rem;
+}
+#endif
+
+#if FEATURE_STATUS
+static void sendStatus( void ){
+	status_t status;
+
+	status.mode = plan.mode;
+	status.outState = outState;
+	status.lowCycles = effectiveCycles(plan.lowCount, plan.lowRem);
+	status.highCycles = effectiveCycles(plan.highCount, plan.highRem);
+	status.rxOverruns = rxOverruns;
+	status.rxFrameErrors = rxFrameErrors;
+	status.uptime = uptime;
+
+	txReply(TX_STATUS, status);
+}
+#endif
+
+#if FEATURE_SELFTEST
+/* Engines that run timer1 themselves, the self-test can not share it */
+static bool tmr1Busy( void ){
+	return (plan.mode == MODE_PWM) || (plan.mode == MODE_STEP)
+		|| (plan.mode == MODE_QUAD) || (plan.mode == MODE_PLL)
+		|| (plan.mode == MODE_SPREAD) || (plan.mode == MODE_POISSON)
+		|| (plan.mode == MODE_SHOT) || (plan.mode == MODE_DELAY) || (plan.mode == MODE_HOP);
+}
+
+static void measStop( void ){
+	TIMSK &= ~((1 << ICIE1) | (1 << TOIE1));
+	TCCR1B = 0;
+	measWindow = 0;
+}
+
+static void measStart(uint8_t window){
+	measStop();
+	if((window == 0) || (timebase == TIMEBASE_EXTERNAL)){
+		return;
+	}
+
+#if FEATURE_JITTER
+	/* The histogram compares with a count plan, the capture ISR must see every edge */
+	if((plan.mode < MODE_COUNT_SHORT) || (plan.mode > MODE_COUNT_LONG)
+		|| (effectiveCycles(plan.lowCount, plan.lowRem) < JITTER_MIN_PHASE)
+		|| (effectiveCycles(plan.highCount, plan.highRem) < JITTER_MIN_PHASE)){
+		return;
+	}
+#endif
+
+	memset((void *)&measure, 0, sizeof(measure));
+	measure.minPeriod = 0xFFFFFFFF;
+	measArmed = false;
+	measOvf = 0;
+	measWindow = window;
+
+	TCCR1A = 0;
+	TCNT1 = 0;
+	TCCR1B = (1 << ICES1) | (1 << CS10);	/* normal mode, no prescaller, rising edge first */
+	TIFR = (1 << ICF1) | (1 << TOV1);
+	TIMSK |= (1 << ICIE1) | (1 << TOIE1);
+}
+#endif
+
+#if FEATURE_PRBS || FEATURE_LINECODE || FEATURE_QUADRATURE || FEATURE_POISSON || FEATURE_DELAY
+/* Smallest prescaller that brings 'value' CPU cycles down to 'limit' ticks,
+ * /1024 at most. Returns the CS bits, CS0 and CS1 values 1 to 5 divide by 1,
+ * 8, 64, 256, 1024, and the division as a shift. */
+static uint8_t tmrPrescale(uint32_t value, uint32_t limit, uint8_t *shift){
+	uint8_t cs = 1;
+
+	*shift = 0;
+	while(((value >> *shift) > limit) && (cs < 5)){
+		*shift += (cs < 3) ? 3 : 2;
+		cs++;
+	}
+	return cs;
+}
+#endif
+
+#if FEATURE_PRBS || FEATURE_LINECODE
+/* Sets plan.highRem to the timer0 prescaller and plan.lowCount to OCR0A for a
+ * compare period of 'period' CPU cycles, rounded down to the prescaller step.
+ * Returns the period actually used. */
+static uint32_t tmr0Period(uint32_t period, uint8_t min){
+	uint8_t cs;
+	uint8_t shift;
+
+	if(period < min){
+		period = min;
+	}
+	cs = tmrPrescale(period, 256, &shift);
+	period >>= shift;
+	if(period > 256){
+		period = 256;
+	}
+
+	plan.highRem = cs;
+	plan.lowCount = period - 1;
+	return period << shift;
+}
+#endif
+
+#if FEATURE_PRBS
+/* Galois feedback, the output bit follows the x^n + x^a + 1 recurrence */
+static const uint32_t prbsMask[PRBS_UNKNOWN] PROGMEM = {
+	0x60,
+	0x6000,
+	0x420000,
+	0x48000000,
+};
+
+static const uint32_t prbsAllOnes[PRBS_UNKNOWN] PROGMEM = {
+	0x7F,
+	0x7FFF,
+	0x7FFFFF,
+	0x7FFFFFFF,
+};
+
+static const uint8_t prbsMinPeriod[PRBS_UNKNOWN] PROGMEM = {
+	24, 24, 32, 32
+};
+
+/* Timer0 prescaller and OCR0A for the bit period, done here so doPrbs starts at once */
+static void makePrbs(uint8_t poly, uint32_t period){
+	if(plan.mode != MODE_PRBS){
+		plan.highCount = 0;
+	}
+	tmr0Period(period, pgm_read_byte(&prbsMinPeriod[poly]));
+	plan.mode = MODE_PRBS;
+	plan.lowRem = poly;
+}
+#endif
+
+#if FEATURE_LINECODE
+static void codePut(uint8_t chip){
+	uint8_t mask = 0x80 >> (codeBit & 7);
+
+	if(codeBit >= CODE_CHIPS * 8){
+		return;
+	}
+	if(chip){
+		codeChips[codeBit >> 3] |= mask;
+	}else{
+		codeChips[codeBit >> 3] &= ~mask;
+	}
+	codeBit++;
+}
+
+/* Encodes the payload into chips and the timer0 setup, doCode only plays them.
+ * Refuses to repeat forever with interrupts off, a stop could never get in. */
+static bool makeCode(uint8_t code, uint8_t len, uint8_t repeat, uint8_t fmt){
+	uint32_t chip = (code == CODE_MANCHESTER) ? (codePeriod >> 1) : codePeriod;
+	uint8_t level = 0;
+	uint8_t i, j, b, bit;
+
+	if((repeat == 0) && (chip < CODE_IRQ_CHIP)){
+		return false;	/* tmr0Period never rounds a chip across CODE_IRQ_CHIP */
+	}
+	if(len > CODE_SIZE){
+		len = CODE_SIZE;
+	}
+	memset(codeChips, (code == CODE_UART) ? 0xFF : 0, CODE_CHIPS);	/* pad with idle */
+	codeIdle = (code == CODE_UART) ? PRBS_SET : PRBS_CLR;
+	codeBit = 0;
+
+	for(i = 0; i < len; i++){
+		b = codeData[i];
+		if(code == CODE_UART){
+			uint8_t parity = (fmt & 3) == CODE_PARITY_ODD;
+
+			codePut(0);
+			for(j = 0; j < 8; j++){
+				bit = b & 1;
+				parity ^= bit;
+				codePut(bit);
+				b >>= 1;
+			}
+			if(fmt & 3){
+				codePut(parity);
+			}
+			codePut(1);
+			if(fmt & CODE_TWO_STOP){
+				codePut(1);
+			}
+			continue;
+		}
+		for(j = 0; j < 8; j++){
+			bit = b >> 7;
+			b <<= 1;
+			if(code == CODE_NRZI){
+				level ^= bit;
+				codePut(level);
+			}else if(code == CODE_MANCHESTER){
+				codePut(!bit);
+				codePut(bit);
+			}else{
+				codePut(bit);
+			}
+		}
+	}
+
+	codeBytes = (codeBit + 7) >> 3;
+	codeRepeat = repeat;
+	chip = tmr0Period(chip, CODE_MIN_CHIP);
+	codeIrqOff = (chip < CODE_IRQ_CHIP);
+	chip = ((uint32_t)pauseLen * 2) / chip;
+	codeGap = (chip == 0) ? 1 : ((chip > 0xFFFF) ? 0xFFFF : chip);
+	plan.mode = MODE_CODE;
+	return true;
+}
+#endif
+
+#if FEATURE_PWM
+/* Timer1 prescaller and top for the frame, done here so doPwm starts at once */
+static void makePwmFrame(uint32_t frame){
+	uint8_t shift = 0;
+	uint8_t cs = (1 << CS10);
+
+	if(frame > (uint32_t)PWM_MAX_FRAME){
+		shift = 3;
+		cs = (1 << CS11);
+	}
+	if(frame > ((uint32_t)PWM_MAX_FRAME << 3)){
+		shift = 6;
+		cs = (1 << CS11) | (1 << CS10);
+	}
+	frame >>= shift;
+	if(frame > PWM_MAX_FRAME){
+		frame = PWM_MAX_FRAME;
+	}
+	pwmNear = (PWM_NEAR >> shift) + 1;
+	pwmEarly = (PWM_EARLY >> shift) + 1;
+	if(frame < 2 * pwmNear){
+		frame = 2 * pwmNear;
+	}
+
+	memset(pwmBuf, 0, sizeof(pwmBuf));
+	plan.mode = MODE_PWM;
+	plan.lowRem = shift;
+	plan.highRem = cs;
+	plan.lowCount = frame - 1;
+}
+
+/* Moves one channel to width t (timer1 steps) in the buffer the ISR is not
+ * playing and hands it over for the next frame start. Runs in the RX ISR, so
+ * every width lands in the schedule in the order sent, ~400 cycles. */
+static void pwmSet(uint8_t ch, uint16_t t){
+	uint16_t top = (uint16_t)plan.lowCount;
+	uint8_t bit = 1 << ch;
+	uint8_t i, j, level;
+	pwm_t *p = &pwmBuf[pwmCur ^ 1];
+
+	if(!pwmSwap){
+		*p = pwmBuf[pwmCur];	/* the newest schedule is the one playing */
+	}
+
+	/* Drop the old width, and its edge where no other channel falls */
+	p->start &= ~bit;
+	level = p->start;
+	for(i = 0, j = 0; i < p->count; i++){
+		if((p->level[i] & ~bit) != level){
+			level = p->level[i] & ~bit;
+			p->time[j] = p->time[i];
+			p->level[j++] = level;
+		}
+	}
+	p->count = j;
+
+	if(t){
+		if(t < pwmNear){
+			t = pwmNear;
+		}
+		/* High up to its edge, equal widths fall together; the frame starts
+		 * one step before TCNT1 = 0 */
+		p->start |= bit;
+		for(i = 0; (i < p->count) && (p->time[i] < t - 1); i++){
+			p->level[i] |= bit;
+		}
+		if((t <= top) && ((i == p->count) || (p->time[i] != t - 1))){
+			for(j = p->count; j > i; j--){
+				p->time[j] = p->time[j - 1];
+				p->level[j] = p->level[j - 1];
+			}
+			p->time[i] = t - 1;
+			p->level[i] = (i ? p->level[i - 1] : p->start) & ~bit;
+			p->count++;
+		}
+	}
+	pwmSwap = true;
+}
+#endif
+
+#if FEATURE_QUADRATURE
+/* Timer1 prescaller and ticks per count. A running engine takes them at the
+ * next A edge, otherwise the engine is started. */
+static void makeQuad(uint8_t dir, uint32_t period){
+	uint8_t cs;
+	uint8_t shift;
+
+	if(period < QUAD_MIN){
+		period = QUAD_MIN;
+	}
+	cs = tmrPrescale(period, 0x8000, &shift);	/* TOP = 2Q - 1 */
+	period >>= shift;
+	if(period > 0x8000){
+		period = 0x8000;
+	}
+
+	plan.lowRem = dir ? 1 : 0;
+	plan.highRem = cs;
+	plan.lowCount = period;
+	if((plan.mode == MODE_QUAD) && (outState == OUT_RUNNING)){
+		quadDirty = true;
+	}else{
+		plan.mode = MODE_QUAD;
+		restartEngine();
+	}
+}
+#endif
+
+#if FEATURE_SPREAD
+/* Nominal phases in CPU cycles and the spread each profile can make exactly */
+static void makeSpread(uint8_t profile, uint8_t step, uint16_t spread){
+	uint32_t pause = pauseLen * 2;
+	uint32_t pulse = pulseLen * 2;
+	uint16_t mask;
+
+	pause = (pause < SPREAD_MIN) ? SPREAD_MIN : (pause > SPREAD_MAX) ? SPREAD_MAX : pause;
+	pulse = (pulse < SPREAD_MIN) ? SPREAD_MIN : (pulse > SPREAD_MAX) ? SPREAD_MAX : pulse;
+	if(spread > pause){
+		spread = pause;
+	}
+	if(spread > pulse){
+		spread = pulse;
+	}
+	if(profile){
+		for(mask = 0; ((mask << 1) | 1) <= spread; mask = (mask << 1) | 1);
+		spread = mask;
+	}else{
+		if(step == 0){
+			step = 1;
+		}
+		spread -= spread % step;	/* the triangle turns at +-spread exactly */
+	}
+
+	plan.mode = MODE_SPREAD;
+	plan.lowRem = profile ? SPREAD_LFSR : SPREAD_TRIANGLE;
+	plan.highRem = step;
+	plan.lowCount = pause;
+	plan.highCount = pulse;
+	spreadMax = spread;
+	restartEngine();
+}
+#endif
+
+#if FEATURE_POISSON
+/* Timer1 prescaller, mean gap and pulse in ticks for 'rate' pulses/s */
+static void makePoisson(uint32_t rate){
+	uint32_t pulse = pulseLen * 2;
+	uint32_t mean;
+	uint8_t cs, cs2;
+	uint8_t shift, shift2;
+
+	if(rate == 0){
+		return;
+	}
+	if(pulse < POISSON_MIN_PULSE){
+		pulse = POISSON_MIN_PULSE;
+	}
+	mean = F_CPU / rate;
+	mean = (mean > pulse + POISSON_MIN_GAP) ? mean - pulse : POISSON_MIN_GAP;
+	/* the larger of the two fits both */
+	cs = tmrPrescale(mean, POISSON_MEAN_MAX, &shift);
+	cs2 = tmrPrescale(pulse, POISSON_PULSE_MAX, &shift2);
+	if(cs2 > cs){
+		cs = cs2;
+		shift = shift2;
+	}
+	mean >>= shift;
+	pulse >>= shift;
+
+	plan.mode = MODE_POISSON;
+	plan.highRem = cs;
+	plan.lowCount = (mean > POISSON_MEAN_MAX) ? POISSON_MEAN_MAX : mean;
+	plan.highCount = (pulse > POISSON_PULSE_MAX) ? POISSON_PULSE_MAX : pulse;
+	restartEngine();
+}
+#endif
+
+#if FEATURE_DELAY
+/* Timer1 prescaller and delay in ticks */
+static void makeDelay(uint32_t delay){
+	uint8_t cs;
+	uint8_t shift;
+
+	if(delay < DELAY_MIN){
+		delay = DELAY_MIN;
+	}
+	cs = tmrPrescale(delay, DELAY_MAX, &shift);
+	delay >>= shift;
+
+	plan.mode = MODE_DELAY;
+	plan.highRem = cs;
+	plan.lowCount = (delay > DELAY_MAX) ? DELAY_MAX : delay;
+	restartEngine();
+}
+#endif
+
+#if FEATURE_HOP
+/* One field of a hop table entry, clamped to what the engine can make */
+static void storeHop(uint8_t n, uint32_t value){
+	hop_t *e = &hopTable[n & (HOP_ENTRIES - 1)];
+
+	switch(n >> 4){
+	case HOP_PAUSE:
+	case HOP_PULSE:
+		value = (value < HOP_MIN) ? HOP_MIN : (value > HOP_MAX) ? HOP_MAX : value;
+		if((n >> 4) == HOP_PAUSE){
+			e->pause = value;
+		}else{
+			e->pulse = value;
+		}
+		break;
+	case HOP_DWELL:
+		e->dwell = (value == 0) ? 1 : (value >= 256) ? 0 : value;
+		break;
+	}
+}
+#endif
+
+#if FEATURE_BINARY
+/* Delay rounds and skips of the counter loop for k cycles per count,
+ * k = BIN_MIN - 3 + 3 rounds + skips not taken */
+static void makeBinary(uint32_t k){
+	uint16_t d;
+	uint8_t r;
+
+	if(k < BIN_MIN){
+		k = BIN_MIN;
+	}
+	if(k > BIN_MAX){
+		k = BIN_MAX;
+	}
+	d = k - (BIN_MIN - 3);
+	r = d % 3;
+
+	plan.lowRem = d / 3;	/* 256 rounds as 0 */
+	plan.highRem = (r == 0) ? 3 : (r == 1) ? 1 : 0;	/* a set bit skips */
+	plan.lowCount = k;
+	plan.mode = MODE_BINARY;
+	restartEngine();
+}
+#endif
+
+static void check_command( void ){
+
+	uint8_t command = rx_buf[0];
+#if FEATURE_LINECODE
+	uint8_t i;
+#endif
+
+	if((command >= CMD_UNKNOWN) || (rx_index != 1 + pgm_read_byte(&cmdArgLen[command]))){
+#if FEATURE_STATUS
+		rxFrameErrors++;
+#endif
+		return;
+	}
+
+	uint32_t raw = ((uint32_t)rx_buf[1] << 24) + ((uint32_t)rx_buf[2] << 16) + ((uint32_t)rx_buf[3] << 8) + rx_buf[4];
+	uint32_t value = raw;
+	if(value > MAX_LEN){
+		value = MAX_LEN;
+	}
+
+	switch(command){
+	case CMD_SET_PAUSE:
+		pauseLen = value;
+		makePlan(PHASE_LOW);
+		restartEngine();
+		break;
+	case CMD_SET_PULSE:
+		pulseLen = value;
+		makePlan(PHASE_HIGH);
+		restartEngine();
+		break;
+#if FEATURE_PRESETS
+	case CMD_STORE:
+		storePlan(bootSlotRam);
+		break;
+	case CMD_PRESET_STORE:
+		if(rx_buf[1] < PRESET_COUNT){
+			storePlan(rx_buf[1]);
+		}
+		break;
+	case CMD_PRESET_RECALL:
+		if(rx_buf[1] < PRESET_COUNT){
+			recallPlan(rx_buf[1]);
+		}
+		break;
+	case CMD_PRESET_BOOT:
+		if(rx_buf[1] < PRESET_COUNT){
+			storeBootSlot(rx_buf[1]);
+		}
+		break;
+#endif
+	case CMD_STOP:
+		if(rx_buf[1] < STOP_UNKNOWN){
+			outState = rx_buf[1];
+			restartEngine();
+		}
+		break;
+	case CMD_RUN:
+		outState = OUT_RUNNING;
+		restartEngine();
+		break;
+#if FEATURE_EXT_CLOCK
+	case CMD_TIMEBASE:
+		if(rx_buf[1] < TIMEBASE_UNKNOWN){
+			timebase = rx_buf[1];
+			makePlan(PHASE_LOW | PHASE_HIGH);
+			restartEngine();
+		}
+		break;
+	case CMD_EXT_DIVIDE:
+		if((raw > MAX_LEN) || (!extPlain(raw >> 1, raw - (raw >> 1)) && ((raw >> 1) < EXT_MIN_TICKS))){
+			break;	/* 0, 1, an odd N under 2 EXT_MIN_TICKS or too long, no other N is made */
+		}
+		timebase = TIMEBASE_EXTERNAL;
+		pauseLen = value >> 1;
+		pulseLen = value - pauseLen;
+		makePlan(PHASE_LOW | PHASE_HIGH);
+		restartEngine();
+		break;
+#endif
+#if FEATURE_SELFTEST
+	case CMD_MEASURE:
+		if(!tmr1Busy()){
+			measStart(rx_buf[1]);
+		}
+		break;
+	case CMD_MEASURE_REPORT:
+		txReply(TX_MEASURE, measure);
+		break;
+#endif
+#if FEATURE_JITTER
+	case CMD_JITTER:
+		memset(jitterHist, 0, sizeof(jitterHist));
+		JITTER_WIDTH = (rx_buf[1] > JITTER_MAX_WIDTH) ? JITTER_MAX_WIDTH : rx_buf[1];
+		break;
+	case CMD_JITTER_REPORT:
+		txReply(TX_JITTER, jitterHist);
+		break;
+#endif
+#if FEATURE_STATUS
+	case CMD_STATUS:
+		sendStatus();
+		break;
+#endif
+#if FEATURE_PRBS
+	case CMD_PRBS:
+		if(rx_buf[1] < PRBS_UNKNOWN){
+			makePrbs(rx_buf[1], raw & 0xFFFFFF);
+			restartEngine();
+		}
+		break;
+	case CMD_PRBS_SEED:
+		if(plan.mode == MODE_PRBS){
+			plan.highCount = raw;
+			restartEngine();
+		}
+		break;
+#endif
+#if FEATURE_LINECODE
+	case CMD_CODE_DATA:
+		for(i = 0; i < 3; i++){
+			if(rx_buf[1] + i < CODE_SIZE){
+				codeData[rx_buf[1] + i] = rx_buf[2 + i];
+			}
+		}
+		break;
+	case CMD_CODE:
+		if((rx_buf[1] < CODE_UNKNOWN) && (rx_buf[2] != 0)
+			&& makeCode(rx_buf[1], rx_buf[2], rx_buf[3], rx_buf[4])){
+			restartEngine();
+		}
+		break;
+	case CMD_CODE_RATE:
+		codePeriod = raw;
+		break;
+#endif
+#if FEATURE_PWM
+	case CMD_PWM_FRAME:
+		makePwmFrame(raw);
+		restartEngine();
+		break;
+	case CMD_PWM:
+		if((rx_buf[1] < PWM_CHANNELS) && (plan.mode == MODE_PWM)){
+			/* no restart, the running engine takes it at a frame start */
+			raw = (raw & 0xFFFFFF) >> plan.lowRem;
+			pwmSet(rx_buf[1], (raw > 0xFFFF) ? 0xFFFF : raw);
+		}
+		break;
+#endif
+#if FEATURE_STEPPER
+	case CMD_STEP_RATE:
+		stepRate = raw;
+		break;
+	case CMD_STEP_ACCEL:
+		stepAccel = raw;
+		break;
+	case CMD_STEP:
+		plan.mode = MODE_STEP;
+		plan.lowRem = rx_buf[1];
+		plan.lowCount = raw & 0xFFFFFF;
+		restartEngine();
+		break;
+#endif
+#if FEATURE_QUADRATURE
+	case CMD_QUAD:
+		makeQuad(rx_buf[1], raw & 0xFFFFFF);
+		break;
+	case CMD_QUAD_INDEX:
+		quadCycles = (value > 0xFFFF) ? 0xFFFF : value;
+		if(plan.mode == MODE_QUAD){
+			restartEngine();
+		}
+		break;
+#endif
+#if FEATURE_BINARY
+	case CMD_BINARY:
+		makeBinary(value);
+		break;
+#endif
+#if FEATURE_SPREAD
+	case CMD_SPREAD:
+		makeSpread(rx_buf[1], rx_buf[2], raw & 0xFFFF);
+		break;
+#endif
+#if FEATURE_DOUBLE_PULSE
+	case CMD_SHOT_LEN:
+		if(rx_buf[1] < 3){
+			raw &= 0xFFFFFF;
+			shotLen[rx_buf[1]] = (raw < SHOT_MIN) ? SHOT_MIN : raw;
+		}
+		break;
+	case CMD_SHOT:
+		if(rx_buf[1] < SHOT_IDLE){
+			plan.mode = MODE_SHOT;
+			plan.lowRem = rx_buf[1];
+			restartEngine();
+		}
+		break;
+#endif
+#if FEATURE_DELAY
+	case CMD_DELAY:
+		makeDelay(value);
+		break;
+#endif
+#if FEATURE_HOP
+	case CMD_HOP_LEN:
+		storeHop(rx_buf[1], raw & 0xFFFFFF);
+		break;
+	case CMD_HOP:
+		if((rx_buf[1] != 0) && (rx_buf[1] <= HOP_ENTRIES) && (rx_buf[2] != 0) && (rx_buf[2] <= 5)){
+			plan.mode = MODE_HOP;
+			plan.lowRem = rx_buf[1];
+			plan.highRem = rx_buf[2];
+			restartEngine();
+		}
+		break;
+#endif
+#if FEATURE_POISSON
+	case CMD_POISSON:
+		makePoisson(raw);
+		break;
+#endif
+#if FEATURE_PDM
+	case CMD_PDM:
+		plan.lowCount = raw & 0xFFFF;	/* read by a running modulator */
+		if(plan.mode != MODE_PDM){
+			plan.mode = MODE_PDM;
+			restartEngine();
+		}
+		break;
+#endif
+#if FEATURE_PLL
+	case CMD_PLL:
+		if(rx_buf[1] && rx_buf[2] && (rx_buf[3] < 3)){
+			plan.mode = MODE_PLL;
+			plan.lowRem = rx_buf[1];
+			plan.highRem = rx_buf[2];
+			plan.lowCount = (1 << CS10) + rx_buf[3];
+			restartEngine();
+		}
+		break;
+#endif
+#if FEATURE_FAST_LINK
+	case CMD_LINK_RATE:
+		if(rx_buf[1] < LINK_UNKNOWN){
+			linkAck(rx_buf[1]);
+		}
+		break;
+#endif
+	}
+}
+
+
+ISR(USART_RX_vect) {
+	uint8_t flags = UCSRA;
+	uint8_t data;
+
+#if FEATURE_STATUS
+	if(flags & (1 << DOR)){
+		rxOverruns++;
+	}
+#endif
+	if(flags & (1 << FE)){
+		/* break or garbage, drop the partial command */
+#if FEATURE_STATUS
+		rxFrameErrors++;
+#endif
+#if FEATURE_FAST_LINK
+		if((linkRate != LINK_9600) && linkBreakSeen()){
+			linkSet(LINK_9600);
+		}
+#endif
+		(void)UDR;
+		rxLen = RX_HUNT;
+		return;
+	}
+
+	data = UDR;
+	if(data == LINK_SYNC){
+		rxLen = 0;
+		rx_index = 0;
+		rxCrc = 0;
+		rxEsc = false;
+		return;
+	}
+	if(rxLen == RX_HUNT){
+		return;
+	}
+	if(data == LINK_ESC){
+		rxEsc = true;
+		return;
+	}
+	if(rxEsc){
+		data ^= 0x20;
+		rxEsc = false;
+	}
+
+	if(rxLen == 0){
+		if((data == 0) || (data > RX_SIZE)){
+			rxLen = RX_HUNT;
+#if FEATURE_STATUS
+			rxFrameErrors++;
+#endif
+			return;
+		}
+		rxLen = data;
+	}else if(rx_index < rxLen){
+		rx_buf[rx_index++] = data;
+	}else{
+		/* crc byte, the frame is complete either way */
+		rxLen = RX_HUNT;
+		if(data == rxCrc){
+			check_command();
+		}else{
+#if FEATURE_STATUS
+			rxFrameErrors++;
+#endif
+		}
+		return;
+	}
+	rxCrc = _crc8_ccitt_update(rxCrc, data);
+}
+
+
+static void init(void)
+{
+	ACSR |= 1 << ACD; /* Disable analog comparer to reduce power consumption */
+
+	DDRB = 0xff;
+	PORTB = 0;
+
+	/* UART init */
+	// set the baud rate
+	UCSRA = (1 << U2X);
+	linkSet(LINK_9600);
+	// enable rx and tx
+#if HAVE_TX
+	UCSRB = (1<<RXEN) | (1<<TXEN);
+#else
+	UCSRB = (1<<RXEN);
+#endif
+	//  enable RX interrupt
+	UCSRB |= (1 << RXCIE);
+
+	rxLen = RX_HUNT;
+	outState = OUT_RUNNING;
+	timebase = TIMEBASE_INTERNAL;
+
+#if FEATURE_STATUS
+	/* Watchdog interrupt (no reset) once a second for the uptime counter */
+	WDTCSR = (1 << WDCE) | (1 << WDE);
+	UPTIME_RUN();
+#endif
+
+#if FEATURE_PRESETS
+	eeSlot = LOG_NONE;
+	eeRecall = LOG_NONE;
+	logScanPos = LOG_NONE;
+	bootSlotRam = eeprom_read_byte(&bootSlot) % PRESET_COUNT;
+	logPos[bootSlotRam] = logFind(bootSlotRam);	/* the scan comes to the same */
+
+	if(!loadPlan(bootSlotRam))
+#endif
+	{
+		memcpy_P((void *)&plan, &defaultPlan, sizeof(plan_t));
+		applyPlan();
+	}
+
+
+	sei();
+}
+
+#define TGL_01us()		while(modeContinueFlag){		\
+			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
+			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
+			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
+			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
+			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
+			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
+			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
+			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
+			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
+			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
+			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
+			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
+			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
+			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
+			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
+			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
+			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
+			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
+			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
+			OUT_TGL(); OUT_TGL(); OUT_TGL();	\
+			OUT_TGL(); OUT_TGL(); OUT_TGL();	}
+
+#define TGL_02us()		while(modeContinueFlag){			\
+			OUT_TGL();	nop();	OUT_TGL(); nop();	\
+			OUT_TGL();	nop();	OUT_TGL(); nop();	\
+			OUT_TGL();	nop();	OUT_TGL(); nop();	\
+			OUT_TGL();	nop();	OUT_TGL(); nop();	\
+			OUT_TGL();	nop();	OUT_TGL(); nop();	\
+			OUT_TGL();	nop();	OUT_TGL(); nop();	\
+			OUT_TGL();	nop();	OUT_TGL(); nop();	\
+			OUT_TGL();	nop();	OUT_TGL(); nop();	\
+			OUT_TGL();	nop();	OUT_TGL(); nop();	\
+			OUT_TGL();	nop();	OUT_TGL(); nop();	\
+			OUT_TGL();	nop();	OUT_TGL(); nop();	\
+			OUT_TGL();	nop();	OUT_TGL(); nop();	\
+			OUT_TGL();	nop();	OUT_TGL(); nop();	\
+			OUT_TGL();	}
+
+#define TGL_04us()		while(modeContinueFlag){			\
+			OUT_TGL();	nop();	nop();	nop();		\
+			OUT_TGL();	nop();	nop();	nop();		\
+			OUT_TGL();	nop();	nop();	nop();		\
+			OUT_TGL();	nop();	nop();	nop();		\
+			OUT_TGL();	nop();	nop();	nop();		\
+			OUT_TGL();	nop();	nop();	nop();		\
+			OUT_TGL();	nop();	nop();	nop();		\
+			OUT_TGL();	nop();	nop();	nop();		\
+			OUT_TGL();	nop();	nop();	nop();		\
+			OUT_TGL();	nop();	nop();	nop();		\
+			OUT_TGL();	}
+
+#define TGL_06us()		while(modeContinueFlag){					\
+			OUT_TGL(); nop(); nop(); nop();	nop();	nop();	\
+			OUT_TGL(); nop(); nop(); nop();	nop();	nop();	\
+			OUT_TGL(); nop(); nop(); nop();	nop();	nop();	\
+			OUT_TGL(); nop(); nop(); nop();	nop();	nop();	\
+			OUT_TGL(); nop(); nop(); nop();	nop();	nop();	\
+			OUT_TGL();}
+
+#define TGL_08us()		while(modeContinueFlag){ OUT_TGL(); nop();	}
+
+#define TGL_1us()		while(modeContinueFlag){	\
+			OUT_TGL(); nop(); nop(); nop();	}
+
+#define TGL_12us()		while(modeContinueFlag){		\
+			OUT_TGL(); nop(); nop();			\
+			nop(); nop(); nop(); }
+
+#define TGL_14us()		while(modeContinueFlag){		\
+			OUT_TGL(); nop(); nop();			\
+			nop(); nop(); nop(); nop();	nop();}
+
+#define TGL_16us()		while(modeContinueFlag){		\
+			OUT_TGL(); nop(); nop(); nop();		\
+			nop(); nop(); nop(); nop(); nop(); nop();}
+
+#define TGL_18us()		while(modeContinueFlag){		\
+			OUT_TGL(); nop(); nop(); nop();		\
+			nop(); nop(); nop(); nop();	nop();	\
+			nop(); nop(); nop();	}
+
+#define TGL_20us()		while(modeContinueFlag){		\
+			OUT_TGL(); nop(); nop(); nop();		\
+			nop(); nop(); nop(); nop();	nop();	\
+			nop(); nop(); nop(); nop();	nop(); }
+
+/* Hold the output in a static state until the next command */
+void doStop( void ){
+	TMR_STOP();
+
+	if(outState == STOP_HIZ){
+		DDRB = 0;
+		PORTB = 0;
+	}else{
+		if(outState == STOP_HIGH){
+			OUT_SET();
+		}else{
+			OUT_CLR();
+		}
+		DDRB = 0xff;
+	}
+
+	while(modeContinueFlag){
+		TX_POLL();
+	}
+}
+
+
+#if FEATURE_TOGGLE
+/* Unrolled PINB toggle loops for periods below 1,5us */
+void doToggle( void ){
+	TMR_STOP();
+	UPTIME_HOLD();
+
+	switch(plan.lowRem){
+	case 0:
+		TGL_01us();
+		break;
+	case 1:
+		TGL_02us();
+		break;
+	case 2:
+		TGL_04us();
+		break;
+	case 3:
+		TGL_06us();
+		break;
+	case 4:
+		TGL_08us();
+		break;
+	case 5:
+		TGL_1us();
+		break;
+	case 6:
+		TGL_12us();
+		break;
+	default:
+		TGL_14us();
+		break;
+	}
+	UPTIME_RUN();
+}
+#endif
+
+
+#if FEATURE_BINARY
+/* Binary counter on PORTB, k cycles per count, 50% duty on every pin */
+void doBinary( void ){
+	uint8_t cnt, tmp;
+
+	TMR_STOP();
+	UPTIME_HOLD();
+
+	/* 12 cycles + 3 per delay round + 1 per skip bit clear, on every count */
+	__asm__ __volatile__ (
+		"	clr %[cnt]				\n"
+		"1:	out %[port], %[cnt]		\n"
+		"	inc %[cnt]				\n"
+		"	lds %[tmp], %[cont]		\n"
+		"	sbrs %[tmp], 0			\n"
+		"	rjmp 3f					\n"
+		"	mov %[tmp], %[rounds]	\n"
+		"2:	dec %[tmp]				\n"
+		"	brne 2b					\n"
+		"	sbrs %[skip], 0			\n"
+		"	rjmp .+0				\n"
+		"	sbrs %[skip], 1			\n"
+		"	rjmp .+0				\n"
+		"	rjmp 1b					\n"
+		"3:							\n"
+		: [cnt] "=&r" (cnt), [tmp] "=&r" (tmp)
+		: [rounds] "r" (plan.lowRem), [skip] "r" (plan.highRem),
+		  [port] "I" (_SFR_IO_ADDR(PORTB)), [cont] "i" (&modeContinueFlag)
+		: "memory"
+	);
+	UPTIME_RUN();
+}
+#endif
+
+
+#if FEATURE_PDM
+/* First order sigma-delta on PORTB, one bit every PDM_CYCLES */
+void doPdm( void ){
+	uint16_t acc = 0x8000;	/* half way, the error is centered */
+	uint16_t level;
+	uint8_t tmp;
+
+	TMR_STOP();
+	UPTIME_HOLD();
+
+	/* PDM_CYCLES per bit, the carry of acc + level is the bit */
+	__asm__ __volatile__ (
+		"1:	lds %A[level], %[plan]		\n"
+		"	lds %B[level], %[plan]+1	\n"
+		"	add %A[acc], %A[level]		\n"
+		"	adc %B[acc], %B[level]		\n"
+		"	sbc %[tmp], %[tmp]			\n"
+		"	out %[port], %[tmp]			\n"
+		"	lds %[tmp], %[cont]			\n"
+		"	sbrs %[tmp], 0				\n"
+		"	rjmp 2f						\n"
+		"	rjmp 1b						\n"
+		"2:								\n"
+		: [acc] "+r" (acc), [level] "=&r" (level), [tmp] "=&r" (tmp)
+		: [plan] "i" (&plan.lowCount), [port] "I" (_SFR_IO_ADDR(PORTB)),
+		  [cont] "i" (&modeContinueFlag)
+		: "memory"
+	);
+	UPTIME_RUN();
+}
+#endif
+
+
+#if FEATURE_DOUBLE_PULSE
+#define SHOT_WAIT()		do{ while(!(TIFR & (1 << OCF1B))); TIFR = (1 << OCF1B); }while(0)
+
+/* Waits for the match at 'at', after which the next one is set up 'next'
+ * cycles later. An ISR between the match and that setup could let timer1 run
+ * past the next match, the edge would come 65536 cycles late, so when 'next'
+ * is short interrupts go off SHOT_SAFE before the match and stay off. */
+static void shotWait(uint16_t at, uint32_t next){
+	if(next >= SHOT_SAFE){
+		sei();
+	}else{
+		for(;;){
+			cli();
+			if((TIFR & (1 << OCF1B)) || ((uint16_t)(at - TCNT1) < SHOT_SAFE)){
+				break;
+			}
+			sei();
+		}
+	}
+	SHOT_WAIT();
+}
+
+/* Waits for the match of the last edge and sets up the next one 'len' cycles
+ * after it, 'com' makes its level. Segments before it keep TCCR1A, so their
+ * matches hold the level of the last edge. */
+static uint16_t shotPhase(uint16_t at, uint32_t len, uint8_t com){
+	while(len > 0xFFFF){
+		shotWait(at, SHOT_SEG);
+		at += SHOT_SEG;
+		OCR1B = at;
+		len -= SHOT_SEG;
+	}
+	shotWait(at, len);
+	at += len;
+	OCR1B = at;
+	TCCR1A = com;
+	return at;
+}
+
+/* Double pulse on OC1B, every edge a compare B match of the free running timer1 */
+void doShot( void ){
+	uint8_t source = plan.lowRem;
+	uint8_t sreg;
+	uint16_t at;
+
+#if FEATURE_SELFTEST
+	measStop();
+#endif
+	TMR_STOP();
+	TMR_CLR_INT();
+
+	/* OC1B low, timer1 free running in normal mode */
+	TCCR1B = 0;
+	TCCR1A = SHOT_CLR;
+	TCCR1C = (1 << FOC1B);
+	TCCR1B = ((source == SHOT_RISE) ? (1 << ICES1) : 0) | (1 << CS10);
+	TIFR = (1 << ICF1);
+
+	if(source != SHOT_IDLE){
+		while((source != SHOT_NOW) && !(TIFR & (1 << ICF1)) && modeContinueFlag){
+			TX_POLL();
+		}
+	}
+	if((source != SHOT_IDLE) && modeContinueFlag){
+		plan.lowRem = SHOT_IDLE;	/* 07 does not fire again */
+
+		/* Interrupts off from the trigger to the first edge and around every
+		 * match with a short setup after it, see shotWait */
+		sreg = SREG;
+		cli();
+		at = (source == SHOT_NOW) ? TCNT1 : ICR1;
+		if((int16_t)(at + SHOT_LEAD - TCNT1) < SHOT_MIN){
+			at = TCNT1;		/* the trigger was seen late */
+		}
+		at += SHOT_LEAD;
+		OCR1B = at;
+		TCCR1A = SHOT_SET;
+		TIFR = (1 << OCF1B);
+		at = shotPhase(at, shotLen[0], SHOT_CLR);
+		at = shotPhase(at, shotLen[1], SHOT_SET);
+		at = shotPhase(at, shotLen[2], SHOT_CLR);
+		shotWait(at, SHOT_SAFE);
+		SREG = sreg;
+
+		shotCount++;
+		while(txLeft && modeContinueFlag){
+			TX_POLL();
+		}
+		txReply(TX_SHOT, shotCount);
+	}
+
+	while(modeContinueFlag){
+		TX_POLL();
+	}
+
+	TCCR1B = 0;
+	TCCR1A = 0;
+}
+#endif
+
+#if FEATURE_DELAY
+/* Sets up the edge at the head of the queue, from the compare B ISR or, when
+ * nothing is set up, from the capture ISR. Edges already due are forced. */
+static inline void delayNext( void ){
+	uint16_t at;
+
+	while(delayTail != delayHead){
+		at = delayFifo[delayTail];
+		delayTail = (delayTail + 1) & (DELAY_FIFO - 1);
+		delayLevel = !delayLevel;
+		TCCR1A = delayLevel ? ((1 << COM1B1) | (1 << COM1B0)) : (1 << COM1B1);
+		OCR1B = at;
+		if((int16_t)(at - TCNT1) >= DELAY_NEAR){
+			TIFR = (1 << OCF1B);
+			delayArmed = true;
+			return;
+		}
+		TCCR1C = (1 << FOC1B);	/* late rather than lost */
+	}
+	delayArmed = false;		/* later matches repeat the last level */
+}
+
+/* Capture ISR of the delay line, every input edge */
+static inline void delayCapture( void ){
+	uint8_t head = delayHead;
+	uint8_t next = (head + 1) & (DELAY_FIFO - 1);
+
+	delayFifo[head] = ICR1 + delayTicks;
+	TCCR1B ^= (1 << ICES1);
+	TIFR = (1 << ICF1);		/* edge select change may set the flag */
+	if(next == delayTail){
+		delayOverflows++;
+		delayReport = true;
+		TIMSK &= ~(1 << ICIE1);
+		restartEngine();
+		return;
+	}
+	delayHead = next;
+	if(!delayArmed){
+		delayNext();
+	}
+}
+
+/* Delay line, the capture ISR queues ICR1 + delay, the compare B ISR plays the queue */
+void doDelay( void ){
+#if FEATURE_SELFTEST
+	measStop();
+#endif
+	TMR_STOP();
+	TMR_CLR_INT();
+
+	/* OC1B starts at the input level, the first edge captured is the other one */
+	delayTicks = plan.lowCount;
+	delayHead = 0;
+	delayTail = 0;
+	delayArmed = false;
+	delayLevel = (PIND & (1 << PD6)) ? 1 : 0;
+	TCCR1B = 0;
+	TCCR1A = delayLevel ? ((1 << COM1B1) | (1 << COM1B0)) : (1 << COM1B1);
+	TCCR1C = (1 << FOC1B);
+	TCCR1B = (delayLevel ? 0 : (1 << ICES1)) | plan.highRem;
+	TIFR = (1 << ICF1) | (1 << OCF1B);
+	TIMSK |= (1 << ICIE1) | (1 << OCIE1B);
+
+	if(delayReport){
+		delayReport = false;
+		txReply(TX_DELAY, delayOverflows);
+	}
+
+	while(modeContinueFlag){
+		TX_POLL();
+	}
+
+	TCCR1B = 0;
+	TCCR1A = 0;
+	TIMSK &= ~((1 << ICIE1) | (1 << OCIE1B));
+}
+#endif
+
+#if FEATURE_SPREAD || FEATURE_HOP || FEATURE_POISSON || FEATURE_STEPPER
+/* Starts timer1 in fast PWM, TOP = OCR1A, OC1B as 'com' sets it, with 'irq'
+ * (OCIE1A or OCIE1B, OCF1x has the same bit) armed. OCR1A and OCR1B are set
+ * in normal mode and again into the buffers, so the first two periods are
+ * the ones given; TCNT1 at TOP makes the first period start one tick after
+ * the clock. */
+static void tmr1FastPwm(uint16_t top, uint16_t ocr1b, uint8_t com, uint8_t irq, uint8_t cs){
+	TCCR1A = 0;
+	TCCR1B = 0;
+	OCR1A = top;
+	OCR1B = ocr1b;
+	TCCR1A = com | (1 << WGM11) | (1 << WGM10);
+	TCCR1B = (1 << WGM13) | (1 << WGM12);
+	OCR1A = top;
+	OCR1B = ocr1b;
+	TCNT1 = top;
+	TIFR = irq;
+	TIMSK |= irq;
+	TCCR1B = (1 << WGM13) | (1 << WGM12) | cs;
+}
+#endif
+
+#if FEATURE_SPREAD || FEATURE_POISSON
+/* Eight steps of the 16 bit Galois LFSR, a fresh byte in the low bits */
+static inline uint16_t lfsrByte(uint16_t lfsr){
+	uint8_t i;
+
+	for(i = 0; i < 8; i++){
+		lfsr = (lfsr >> 1) ^ ((lfsr & 1) ? LFSR_POLY : 0);
+	}
+	return lfsr;
+}
+#endif
+
+#if FEATURE_SPREAD
+/* Compare A ISR of the spread spectrum, at TOP. The buffers took this
+ * period's values, the next period goes into them. */
+static inline void spreadIsr( void ){
+	int16_t p;
+	uint16_t d;
+
+	if(plan.lowRem == SPREAD_LFSR){
+		spreadLfsr = lfsrByte(spreadLfsr);
+		d = spreadLfsr & spreadMax;
+		p = d - spreadLast;
+		spreadLast = d;
+	}else{
+		p = spreadP;
+		spreadP += spreadDir;
+		if((spreadP >= (int16_t)spreadMax) || (spreadP <= -(int16_t)spreadMax)){
+			spreadDir = -spreadDir;
+		}
+	}
+	OCR1B = spreadPause + (p >> 1);
+	OCR1A = spreadTop + p;
+}
+
+/* Spread spectrum in fast PWM, the compare A ISR buffers the next period */
+void doSpread( void ){
+#if FEATURE_SELFTEST
+	measStop();
+#endif
+	TMR_STOP();
+	TMR_CLR_INT();
+
+	spreadPause = plan.lowCount;
+	spreadTop = plan.lowCount + plan.highCount - 1;
+	spreadP = -(int16_t)spreadMax;
+	spreadDir = spreadMax ? plan.highRem : 0;
+	spreadLfsr = 1;
+	spreadLast = 0;
+
+	/* OC1B set at OCR1B and cleared at BOTTOM, the first two periods are
+	 * nominal and the first pause starts one tick after the clock */
+	tmr1FastPwm(spreadTop, spreadPause, (1 << COM1B1) | (1 << COM1B0),
+		(1 << OCIE1A), (1 << CS10));
+
+	while(modeContinueFlag){
+		TX_POLL();
+	}
+
+	TCCR1B = 0;
+	TCCR1A = 0;
+	TIMSK &= ~(1 << OCIE1A);
+}
+#endif
+
+#if FEATURE_HOP
+/* Reads entry i for the next hop */
+static inline void hopLoad(uint8_t i){
+	hop_t *e = &hopTable[i];
+
+	hopIndex = i;
+	hopPause = e->pause;
+	hopTop = e->pause + e->pulse - 1;
+	hopDwell = e->dwell;
+}
+
+/* Compare A ISR of the hopping, at TOP. In the last period of an entry the
+ * next one goes into the buffers and the one after it is read. */
+static inline void hopIsr( void ){
+	uint8_t i;
+
+	if(--hopLeft){
+		return;
+	}
+	OCR1B = hopPause;
+	OCR1A = hopTop;
+	hopLeft = hopDwell;
+	i = hopIndex + 1;
+	hopLoad((i < plan.lowRem) ? i : 0);
+}
+
+/* Hopping in fast PWM, the next entry goes into the buffers in the last period */
+void doHop( void ){
+	uint16_t top, pause;
+	uint8_t i;
+
+#if FEATURE_SELFTEST
+	measStop();
+#endif
+	TMR_STOP();
+	TMR_CLR_INT();
+
+	/* Phases never written are the shortest, an unwritten dwell is 256 */
+	for(i = 0; i < plan.lowRem; i++){
+		if(hopTable[i].pause == 0){
+			hopTable[i].pause = HOP_MIN;
+		}
+		if(hopTable[i].pulse == 0){
+			hopTable[i].pulse = HOP_MIN;
+		}
+	}
+	hopLoad(0);
+	hopLeft = hopDwell;
+	top = hopTop;
+	pause = hopPause;
+	hopLoad((plan.lowRem > 1) ? 1 : 0);
+
+	/* As doSpread: the first TOP, one tick after the start, begins entry 0
+	 * and the ISR loads the next one */
+	tmr1FastPwm(top, pause, (1 << COM1B1) | (1 << COM1B0), (1 << OCIE1A),
+		plan.highRem);
+
+	while(modeContinueFlag){
+		TX_POLL();
+	}
+
+	TCCR1B = 0;
+	TCCR1A = 0;
+	TIMSK &= ~(1 << OCIE1A);
+}
+#endif
+
+#if FEATURE_POISSON
+/* Mean of each of the lower 127 of 128 equally likely bins of the unit
+ * exponential, 1 + (a e^-a - b e^-b) / (e^-a - e^-b) for the bin from
+ * a = -ln(1 - u / 128) to b = -ln(1 - (u + 1) / 128), 8.8 fixed point, the
+ * rounding nudged so that with POISSON_TAIL they sum to 127 * 256, mean 1. */
+static const uint16_t poissonCdf[POISSON_BINS - 1] PROGMEM = {
+	1, 3, 5, 7, 9, 11, 13, 15,
+	18, 20, 22, 24, 26, 29, 31, 33,
+	35, 38, 40, 42, 45, 47, 50, 52,
+	54, 57, 59, 62, 65, 67, 70, 72,
+	75, 78, 80, 83, 86, 89, 92, 94,
+	97, 100, 103, 106, 109, 112, 116, 119,
+	122, 125, 128, 132, 135, 139, 142, 146,
+	149, 153, 156, 160, 164, 168, 172, 175,
+	179, 184, 188, 192, 196, 200, 205, 209,
+	214, 219, 223, 228, 233, 238, 243, 248,
+	254, 259, 265, 271, 276, 282, 288, 295,
+	301, 308, 314, 321, 328, 336, 343, 351,
+	359, 367, 376, 385, 394, 403, 413, 423,
+	434, 445, 457, 469, 482, 495, 509, 525,
+	541, 558, 576, 596, 617, 640, 666, 694,
+	727, 763, 806, 858, 922, 1009, 1143,
+};
+
+/* Compare A ISR of the Poisson engine, at TOP, as the pulse starts. The gap
+ * after the next pulse goes into the OCR1A buffer. */
+static inline void poissonIsr( void ){
+	uint16_t t = 0;		/* means, 8.8 */
+	uint32_t m = poissonMean;
+	uint32_t gap = 0;
+	uint8_t u;
+
+	for(;;){
+		poissonLfsr = lfsrByte(poissonLfsr);
+		u = poissonLfsr & (POISSON_BINS - 1);
+		if(u != POISSON_BINS - 1){
+			t += pgm_read_word(&poissonCdf[u]);
+			break;
+		}
+		t += POISSON_TAIL;	/* past ln(128) means, the rest is a new draw */
+		if(t >= POISSON_CAP){
+			break;
+		}
+	}
+	/* t * mean, no MUL on the ATtiny */
+	while(t){
+		if(t & 1){
+			gap += m;
+		}
+		m <<= 1;
+		t >>= 1;
+	}
+	gap = (gap + 128) >> 8;
+	if(gap == 0){
+		gap = 1;
+	}else if(gap > poissonMax){
+		gap = poissonMax;
+	}
+	OCR1A = poissonPulse + gap - 1;
+}
+
+/* Poisson pulses in fast PWM, the compare A ISR draws the next gap */
+void doPoisson( void ){
+#if FEATURE_SELFTEST
+	measStop();
+#endif
+	TMR_STOP();
+	TMR_CLR_INT();
+
+	poissonMean = plan.lowCount;
+	poissonPulse = plan.highCount;
+	poissonMax = 0xFFFF - poissonPulse;
+	poissonLfsr = 1;
+
+	/* OC1B high from BOTTOM to OCR1B. The first gap is the mean, the first
+	 * pulse starts one tick after the clock. */
+	tmr1FastPwm(poissonPulse + poissonMean - 1, poissonPulse, (1 << COM1B1),
+		(1 << OCIE1A), plan.highRem);
+
+	while(modeContinueFlag){
+		TX_POLL();
+	}
+
+	TCCR1B = 0;
+	TCCR1A = 0;
+	TIMSK &= ~(1 << OCIE1A);
+}
+#endif
+
+
+ISR (TIMER0_COMPA_vect)
+{
+	tmr0CycleCount++;
+}
+
+
+#if FEATURE_STATUS
+ISR (WDT_OVERFLOW_vect)
+{
+	uptime++;
+}
+#endif
+
+
+#if FEATURE_SELFTEST
+ISR (TIMER1_OVF_vect)
+{
+	measOvf++;
+}
+
+
+#if FEATURE_JITTER
+/* Count plan phase in CPU cycles, modulo 2^16 like the deviation */
+#define JITTER_PHASE(count, rem)	((uint16_t)((uint16_t)(count) * TMR0_MAX_COUNT + (rem)))
+
+/* Bins how far a measured time is from the plan, in CPU cycles */
+static inline void jitterAdd(uint16_t len, uint16_t planned){
+	int16_t d;
+	uint8_t bin;
+
+	if((plan.mode < MODE_COUNT_SHORT) || (plan.mode > MODE_COUNT_LONG)){
+		return;		/* a new plan during the window, not a count engine */
+	}
+	d = (int16_t)(len - planned) >> JITTER_WIDTH;
+	if(d < -(JITTER_BINS / 2)){
+		bin = 0;
+	}else if(d >= JITTER_BINS / 2){
+		bin = JITTER_BINS - 1;
+	}else{
+		bin = d + JITTER_BINS / 2;
+	}
+	if(jitterHist[bin] != 0xFFFF){
+		jitterHist[bin]++;
+	}
+}
+#endif
+
+static inline void measCapture( void ){
+	uint16_t low = ICR1;
+	uint16_t high = measOvf;
+
+	/* Overflow pending but not yet counted */
+	if((TIFR & (1 << TOV1)) && (low < 0x8000)){
+		high++;
+	}
+
+	uint32_t stamp = ((uint32_t)high << 16) | low;
+
+	if(TCCR1B & (1 << ICES1)){
+		if(measArmed){
+			uint32_t period = stamp - measRise;
+
+#if FEATURE_JITTER
+			jitterAdd(period, JITTER_PHASE(plan.lowCount, plan.lowRem)
+				+ JITTER_PHASE(plan.highCount, plan.highRem));
+#endif
+			if(period < measure.minPeriod){
+				measure.minPeriod = period;
+			}
+			if(period > measure.maxPeriod){
+				measure.maxPeriod = period;
+			}
+			measure.sumPeriod += period;
+			if(++measure.count == measWindow){
+				measStop();
+				return;
+			}
+		}
+		measRise = stamp;
+		measArmed = true;
+	}else if(measArmed){
+		measure.sumHigh += stamp - measRise;
+#if FEATURE_JITTER
+		jitterAdd(stamp - measRise, JITTER_PHASE(plan.highCount, plan.highRem));
+#endif
+	}
+
+	TCCR1B ^= (1 << ICES1);
+	TIFR = (1 << ICF1);	/* edge select change may set the flag */
+}
+#endif
+
+
+/* Count engines, timer0 periods plus a remainder per phase, edges set by the loop */
+void doCounting( void ){
+	OCR0A  = TMR0_MAX_COUNT - 1;// number to count up to.
+	TCCR0A = (1 << WGM01); 		// CTC mode
+
+	TMR_SET_INT();
+	tmr0CycleCount = 0;
+
+	uint8_t mode = plan.mode;
+	uint8_t tmrLowRemanant = plan.lowRem;
+	uint8_t tmrHighRemanant = plan.highRem;
+	uint32_t tmrLowCycleCount = plan.lowCount;
+	uint32_t tmrHighCycleCount = plan.highCount;
+
+	TMR_START();
+	if(mode == MODE_COUNT_SHORT){
+
+		if(tmrLowRemanant > 16){
+			tmrLowRemanant -= 16;
+		}
+
+		if(tmrHighRemanant > 12){
+			tmrHighRemanant -= 12;
+		}
+
+		TMR_CLR_INT();
+		UPTIME_HOLD();
+
+		while(modeContinueFlag){
+			while(TCNT0 < tmrLowRemanant);
+			OUT_SET();
+			TCNT0 = 0;
+			while(TCNT0 < tmrHighRemanant);
+			OUT_CLR();
+			TCNT0 = 0;
+		}
+		UPTIME_RUN();
+
+	}else if(mode == MODE_COUNT_LONG_HIGH){
+
+		while(modeContinueFlag){
+			while(TCNT0 < tmrLowRemanant);
+			OUT_SET();
+			TCNT0 = 0;
+			tmr0CycleCount = 0;
+			if(!modeContinueFlag){
+				break;	/* do not wait out a whole phase of the old plan */
+			}
+			TX_POLL();
+			while(tmr0CycleCount < tmrHighCycleCount);
+			while(TCNT0 < tmrHighRemanant);
+			OUT_CLR();
+			TCNT0 = 0;
+		}
+	}else if(mode == MODE_COUNT_LONG_LOW){
+
+		while(modeContinueFlag){
+			while(TCNT0 < tmrHighRemanant);
+			OUT_CLR();
+			TCNT0 = 0;
+			tmr0CycleCount = 0;
+			if(!modeContinueFlag){
+				break;	/* do not wait out a whole phase of the old plan */
+			}
+			TX_POLL();
+			while(tmr0CycleCount < tmrLowCycleCount);
+			while(TCNT0 < tmrLowRemanant);
+			OUT_SET();
+			TCNT0 = 0;
+		}
+	}else{
+
+		while(modeContinueFlag){
+			while(tmr0CycleCount < tmrLowCycleCount);
+			while(TCNT0 < tmrLowRemanant);
+			OUT_SET();
+			TCNT0 = 0;
+			tmr0CycleCount = 0;
+			if(!modeContinueFlag){
+				break;	/* do not wait out a whole phase of the old plan */
+			}
+			TX_POLL();
+			while(tmr0CycleCount < tmrHighCycleCount);
+			while(TCNT0 < tmrHighRemanant);
+			OUT_CLR();
+			TCNT0 = 0;
+			tmr0CycleCount = 0;
+			if(!modeContinueFlag){
+				break;	/* do not wait out a whole phase of the old plan */
+			}
+			TX_POLL();
+		}
+	}
+
+	TMR_STOP();
+
+}
+
+
+#if FEATURE_EXT_CLOCK
+/* Length of the first segment of a phase, the rest are EXT_SEG_LEN long.
+ * makePlan keeps ticks at EXT_MIN_TICKS or more. */
+static uint16_t extSplit(uint32_t ticks){
+	if(ticks <= 0xFFFF){
+		extLeft = 0;
+		return ticks;
+	}
+	extLeft = (ticks >> 15) - 1;
+	return EXT_SEG_LEN | (ticks & (EXT_SEG_LEN - 1));
+}
+
+/* Runs right after a compare match and sets up the segment that just started.
+ * OCR1A is not buffered in CTC mode: when an ISR held this one off until TCNT1
+ * passed the new value, the segment end is forced now, late, instead of
+ * after a 65536 tick wrap. */
+static inline void extIsr( void ){
+	for(;;){
+		if(extLeft){
+			extLeft--;
+			OCR1A = EXT_SEG_LEN - 1;
+		}else{
+			extHigh = !extHigh;
+			OCR1A = extSplit(extHigh ? plan.highCount : plan.lowCount) - 1;
+		}
+
+		if(extLeft){
+			TCCR1A = extHigh ? EXT_HOLD_HIGH : EXT_HOLD_LOW;
+		}else{
+			TCCR1A = extHigh ? EXT_HOLD_LOW : EXT_HOLD_HIGH;
+		}
+
+		if((TCNT1 < OCR1A) || (TIFR & (1 << OCF1A))){
+			return;
+		}
+		TCNT1 = 0;
+		TCCR1C = (1 << FOC1A);
+	}
+}
+
+
+/* External timebase, OC1A from the timer1 compare in reference ticks */
+void doExtClock( void ){
+	uint32_t lowTicks = plan.lowCount;
+
+#if FEATURE_SELFTEST
+	measStop();
+#endif
+	TCNT1 = 0;
+
+	if(extPlain(lowTicks, plan.highCount)){
+		/* Plain divider, the compare hardware toggles OC1A on its own */
+		OCR1A = lowTicks - 1;
+		TCCR1A = (1 << COM1A0);
+	}else{
+		extHigh = false;
+		OCR1A = extSplit(lowTicks) - 1;
+		TCCR1A = extLeft ? EXT_HOLD_LOW : EXT_HOLD_HIGH;
+		TIMSK |= (1 << OCIE1A);
+	}
+	EXT_START();
+
+	while(modeContinueFlag){
+		TX_POLL();
+	}
+
+	EXT_STOP();
+}
+#endif
+
+
+#if FEATURE_PRBS
+/* One Galois step, the output bit is bit 0 */
+#define PRBS_STEP(s, m)		(((s) & 1) ? (((s) >> 1) ^ (m)) : ((s) >> 1))
+
+/* The next bit is set up right after a match, the LFSR steps while waiting */
+#define PRBS_LOOP(type)		{								\
+		type s = (type)lfsr;								\
+		type m = (type)mask;								\
+		TCCR0A = (s & 1) ? PRBS_SET : PRBS_CLR;				\
+		TCCR0B = plan.highRem;								\
+		while(modeContinueFlag){							\
+			s = PRBS_STEP(s, m);							\
+			while((TIFR & (1 << OCF0A)) == 0);				\
+			TCCR0A = (s & 1) ? PRBS_SET : PRBS_CLR;			\
+			TIFR = (1 << OCF0A);							\
+		}													\
+	}
+
+/* PRBS on OC0A, the compare hardware makes the edges */
+void doPrbs( void ){
+	uint8_t poly = plan.lowRem;
+	uint32_t mask = pgm_read_dword(&prbsMask[poly]);
+	uint32_t lfsr = plan.highCount & pgm_read_dword(&prbsAllOnes[poly]);
+
+	if(lfsr == 0){
+		lfsr = pgm_read_dword(&prbsAllOnes[poly]);
+	}
+
+	TMR_STOP();
+	TMR_CLR_INT();
+	OCR0A = (uint8_t)plan.lowCount;
+	TCNT0 = 0;
+	TIFR = (1 << OCF0A);
+
+	if(poly <= PRBS_15){
+		PRBS_LOOP(uint16_t);
+	}else{
+		PRBS_LOOP(uint32_t);
+	}
+
+	TMR_STOP();
+	TCCR0A = 0;		/* OC0A back to PORTB */
+}
+#endif
+
+
+#if FEATURE_LINECODE
+/* Line code chips on OC0A, the level of the next chip armed after every match */
+void doCode( void ){
+	uint8_t data, left, com, tmp;
+	uint16_t cnt;
+	uint8_t rep = codeRepeat;
+	const uint8_t *ptr;
+
+	TMR_STOP();
+	TMR_CLR_INT();
+	OCR0A = (uint8_t)plan.lowCount;
+	TCNT0 = 0;
+	TCCR0A = codeIdle;
+	TCCR0B = (1 << FOC0A);	/* OC0A to the idle level now */
+	TIFR = (1 << OCF0A);
+	TCCR0B = plan.highRem;
+
+	/* After each match the level of the next chip is armed in TCCR0A, so a
+	 * chip only has to be computed within one chip period: ~12 cycles, ~22 when
+	 * a new byte is loaded and ~26 from the gap into a new frame, which the
+	 * following short iterations catch up. A byte holds 8 chips, a marker bit
+	 * shifted in behind them tells when it is empty. */
+	__asm__ __volatile__ (
+		"	sbrc %[irq], 0			\n"
+		"	cli						\n"
+		"1:	movw %A[ptr], %A[base]	\n"	/* new frame */
+		"	mov %[left], %[bytes]	\n"
+		"2:	ld %[data], %a[ptr]+	\n"	/* new byte */
+		"	sec						\n"
+		"	rol %[data]				\n"
+		"	rjmp 4f					\n"
+		"3:	lsl %[data]				\n"	/* next chip to carry */
+		"	breq 6f					\n"
+		"4:	ldi %[com], %[clr]		\n"
+		"	brcc 5f					\n"
+		"	ldi %[com], %[set]		\n"
+		"5:	in %[tmp], %[tifr]		\n"
+		"	sbrs %[tmp], %[ocf]		\n"
+		"	rjmp 5b					\n"
+		"	out %[tccr], %[com]		\n"
+		"	out %[tifr], %[flag]	\n"
+		"	rjmp 3b					\n"
+		"6:	dec %[left]				\n"
+		"	brne 2b					\n"
+		"	sei						\n"	/* gap, commands are taken here */
+		"	movw %A[cnt], %A[gap]	\n"
+		"7:	in %[tmp], %[tifr]		\n"
+		"	sbrs %[tmp], %[ocf]		\n"
+		"	rjmp 7b					\n"
+		"	out %[tccr], %[idle]	\n"
+		"	out %[tifr], %[flag]	\n"
+		"	lds %[tmp], %[cont]		\n"
+		"	tst %[tmp]				\n"
+		"	breq 8f					\n"
+		"	subi %A[cnt], 1			\n"
+		"	sbci %B[cnt], 0			\n"
+		"	brne 7b					\n"
+		"	tst %[rep]				\n"
+		"	breq 9f					\n"	/* repeat forever */
+		"	dec %[rep]				\n"
+		"	breq 8f					\n"
+		"9:	sbrc %[irq], 0			\n"
+		"	cli						\n"
+		"	rjmp 1b					\n"
+		"8:							\n"
+		: [ptr] "=&x" (ptr), [data] "=&r" (data), [left] "=&r" (left),
+		  [com] "=&d" (com), [tmp] "=&r" (tmp), [cnt] "=&d" (cnt), [rep] "+r" (rep)
+		: [base] "r" (codeChips), [bytes] "r" (codeBytes), [gap] "r" (codeGap),
+		  [idle] "r" (codeIdle), [flag] "r" ((uint8_t)(1 << OCF0A)), [irq] "r" (codeIrqOff),
+		  [clr] "M" (PRBS_CLR), [set] "M" (PRBS_SET), [ocf] "I" (OCF0A),
+		  [tifr] "I" (_SFR_IO_ADDR(TIFR)), [tccr] "I" (_SFR_IO_ADDR(TCCR0A)),
+		  [cont] "i" (&modeContinueFlag)
+		: "memory"
+	);
+
+	/* all repeats sent, hold the idle level */
+	while(modeContinueFlag){
+		TX_POLL();
+	}
+
+	TMR_STOP();
+	TCCR0A = 0;
+}
+#endif
+
+
+#if FEATURE_PWM
+/* Compare B ISR of the PWM, one interrupt per distinct edge time. The match is
+ * pwmEarly steps ahead of the edge and every edge, the frame start included,
+ * is written by a poll, so the ISR latency drops out of the widths. Frame end
+ * is the match at top, where the CTC clears TCNT1; OCF1A tells it apart even
+ * when the ISR comes late. */
+static inline void pwmIsr( void ){
+	const pwm_t *p = &pwmBuf[pwmCur];
+	uint8_t i = pwmEdge;
+	uint8_t level;
+	uint16_t t;
+
+	for(;;){
+		if((i == p->count) || (TIFR & (1 << OCF1A))){
+			if(pwmSwap){
+				pwmCur ^= 1;
+				pwmSwap = false;
+				p = &pwmBuf[pwmCur];
+			}
+			level = p->start;
+			while((TIFR & (1 << OCF1A)) == 0);
+			PORTB = level;
+			TIFR = (1 << OCF1A);
+			i = 0;
+		}else{
+			level = p->level[i];
+			t = p->time[i++];
+			while(TCNT1 < t);
+			PORTB = level;
+		}
+
+		if(TIFR & (1 << OCF1A)){
+			continue;	/* late, the frame is over */
+		}
+		t = (i < p->count) ? p->time[i] : OCR1A;
+		if((TCNT1 < t) && (t - TCNT1 > pwmNear)){
+			break;
+		}
+	}
+	OCR1B = t - pwmEarly;
+	pwmEdge = i;
+}
+
+
+/* Servo PWM on PORTB from the sorted edge schedule */
+void doPwm( void ){
+#if FEATURE_SELFTEST
+	measStop();
+#endif
+	TMR_STOP();
+	TMR_CLR_INT();
+
+	/* First frame starts pwmNear steps from now */
+	pwmEdge = pwmBuf[pwmCur].count;
+	OCR1A = (uint16_t)plan.lowCount;
+	OCR1B = OCR1A - pwmEarly;
+	TCNT1 = OCR1A - pwmNear;
+	TCCR1A = 0;
+	TIFR = (1 << OCF1A) | (1 << OCF1B);
+	TIMSK |= (1 << OCIE1B);
+	TCCR1B = (1 << WGM12) | plan.highRem;	/* CTC, top OCR1A */
+
+	while(modeContinueFlag){
+		TX_POLL();
+#if HAVE_REPLY
+		if(txLeft){
+			continue;	/* no TX interrupt would wake us */
+		}
+#endif
+		/* Sleep unless an ISR ended the loop meanwhile */
+		cli();
+		if(modeContinueFlag){
+			sleep_enable();
+			sei();
+			sleep_cpu();
+			sleep_disable();
+		}
+		sei();
+	}
+
+	TCCR1B = 0;
+	TIMSK &= ~(1 << OCIE1B);
+}
+#endif
+
+
+#if FEATURE_STEPPER
+static uint16_t isqrt(uint32_t x){
+	uint32_t r = 0;
+	uint32_t bit = (uint32_t)1 << 30;
+
+	while(bit > x){
+		bit >>= 2;
+	}
+	while(bit){
+		if(x >= r + bit){
+			x -= r + bit;
+			r = (r >> 1) + bit;
+		}else{
+			r >>= 1;
+		}
+		bit >>= 2;
+	}
+	return (uint16_t)r;
+}
+
+/* Prescaller, top rate and the ramp at step 1, with the recurrence state set
+ * up for step 2. The only divisions of a move are here. Returns the CS1 bits. */
+static uint8_t stepSetup( void ){
+	uint32_t accel = (stepAccel < 2) ? 2 : stepAccel;
+	uint32_t rate = (stepRate == 0) ? 1 : stepRate;
+	uint32_t k;
+	uint8_t shift;		/* log2 of the prescaller */
+	uint8_t cs;
+
+	/* K must stay below 2^31 for the recurrence */
+	if(accel >= 1456){
+		shift = 3;
+		cs = (1 << CS11);
+	}else if(accel >= 23){
+		shift = 6;
+		cs = (1 << CS11) | (1 << CS10);
+	}else{
+		shift = 8;
+		cs = (1 << CS12);
+	}
+	k = (STEP_KA / accel) << (2 * (8 - shift));
+
+	rate = (F_CPU >> shift) / rate;
+	if(rate < (STEP_MIN_CYCLES >> shift)){
+		rate = STEP_MIN_CYCLES >> shift;
+	}
+	stepMin = (rate > 0xFFFF) ? 0xFFFF : rate;
+
+	stepC1 = isqrt(k);
+	stepC2 = isqrt(k >> 1);
+	stepSq = (uint32_t)stepC2 * stepC2;
+	stepU = 2 * (2 * (uint32_t)stepC2 - 1);
+	stepD = k - 2 * stepSq;
+
+	stepN = 1;
+	stepC = stepC1;
+	OCR1B = ((STEP_PULSE >> shift) == 0) ? 0 : (STEP_PULSE >> shift) - 1;
+	return cs;
+}
+
+/* Interval to the step after which 'left' steps remain, left > 0. Moves the
+ * ramp one step up, keeps it, or moves it one step down to n = left, so the
+ * way down mirrors the way up. */
+static uint16_t stepAdvance(uint32_t left){
+	if((stepN < left) && (stepC > stepMin)){
+		if(++stepN == 2){
+			stepC = stepC2;
+		}else{
+			stepU += 2 * stepC - 1;
+			stepD -= stepSq;
+			while(stepD < 0){
+				stepD += stepU;
+				stepSq -= 2 * stepC - 1;
+				stepU -= 2 * stepN;
+				stepC--;
+			}
+		}
+	}else if(left < stepN){
+		if(--stepN <= 2){
+			stepC = (stepN == 2) ? stepC2 : stepC1;
+		}else{
+			stepD += stepSq;
+			stepU -= 2 * stepC - 1;
+			while(stepD >= (int32_t)(stepU + 2 * stepN)){
+				stepD -= stepU + 2 * stepN;
+				stepSq += 2 * stepC + 1;
+				stepU += 2 * stepN;
+				stepC++;
+			}
+		}
+	}
+	return (stepC < stepMin) ? stepMin : stepC;
+}
+
+/* Compare B ISR of the stepper, at the end of each step pulse. OCR1A is double
+ * buffered in fast PWM, the value written here runs after the current interval. */
+static inline void stepIsr( void ){
+	OCR1A = stepNext - 1;
+	if(--stepLeft == 0){
+		TCCR1B = 0;		/* OC1B is already low */
+		return;
+	}
+	stepNeed = true;
+}
+
+/* Step/dir move, main() computes each interval one step ahead of the ISR */
+void doStep( void ){
+	uint32_t steps;
+	uint32_t remain;
+	int32_t left;		/* steps left after the next interval to compute */
+	uint16_t next;
+	uint8_t cs;
+
+#if FEATURE_SELFTEST
+	measStop();
+#endif
+	TMR_STOP();
+	TMR_CLR_INT();
+
+	cli();
+	steps = plan.lowCount;
+	plan.lowCount = 0;		/* 07 does not repeat the move */
+	sei();
+
+	if(steps != 0){
+		cs = stepSetup();
+		stepLeft = steps;
+		stepNeed = false;
+		next = (stepC < stepMin) ? stepMin : stepC;
+		stepNext = (steps > 2) ? stepAdvance(steps - 2) : next;
+		left = steps - 3;
+		if(plan.lowRem){
+			PORTB = STEP_DIR;
+		}
+
+		/* OC1B high from BOTTOM to OCR1B, the pulse stepSetup set, the
+		 * first step one tick after the clock */
+		tmr1FastPwm(next - 1, OCR1B, (1 << COM1B1), (1 << OCIE1B), cs);
+
+		/* stepLeft is read under cli(), the ISR may count it down between
+		 * the bytes of a plain read and show 0 while steps remain */
+		for(;;){
+			cli();
+			remain = stepLeft;
+			sei();
+			if(!modeContinueFlag || (remain == 0)){
+				break;
+			}
+			if(stepNeed){
+				stepNeed = false;
+				if(left > 0){
+					next = stepAdvance(left--);
+					cli();
+					stepNext = next;
+					sei();
+				}
+			}
+			TX_POLL();
+		}
+
+		TCCR1B = 0;
+		TCCR1A = 0;
+		TIMSK &= ~(1 << OCIE1B);
+
+		while(txLeft && modeContinueFlag){
+			TX_POLL();
+		}
+		steps -= stepLeft;	/* the ISR is off, stepLeft holds still */
+		txReply(TX_STEP, steps);
+	}
+
+	while(modeContinueFlag){
+		TX_POLL();
+	}
+}
+#endif
+
+
+#if FEATURE_QUADRATURE
+/* Compare B ISR of the quadrature, only runs with an index */
+static inline void quadIsr( void ){
+	uint8_t b = PINB & (1 << PB4);
+
+	if(b == quadB){
+		return;		/* the skipped match of a reversal */
+	}
+	quadB = b;
+	if(b){
+		if(quadDir){
+			quadPos = (quadPos == 0) ? quadCycles - 1 : quadPos - 1;
+		}else if(++quadPos == quadCycles){
+			quadPos = 0;
+		}
+		if(quadPos == 0){
+			PORTB |= QUAD_INDEX;
+		}
+	}else{
+		PORTB &= ~QUAD_INDEX;
+	}
+}
+
+/* Waits for the next A edge and returns right after its match with interrupts
+ * off. With interrupts on an ISR can delay us past the point where a change is
+ * still in time, then the next edge is taken. */
+static bool quadEdge(bool irqOff){
+	uint8_t late = ((TCCR1B & 7) == (1 << CS10)) ? 16 : 2;
+
+	TIFR = (1 << OCF1A);
+	for(;;){
+		if(irqOff){
+			cli();
+		}
+		while((TIFR & (1 << OCF1A)) == 0){
+			if(!modeContinueFlag){
+				sei();
+				return false;
+			}
+		}
+		cli();
+		if(TCNT1 < late){
+			return true;
+		}
+		TIFR = (1 << OCF1A);
+		sei();
+	}
+}
+
+/* New rate or direction from the plan, see the header */
+static void quadUpdate( void ){
+	uint16_t q;
+	uint8_t cs;
+	bool flip;
+	bool irqOff;
+
+	cli();
+	irqOff = (((TCCR1B & 7) == (1 << CS10)) && (OCR1B < QUAD_IRQ_CYCLES))
+		|| ((plan.highRem == (1 << CS10)) && (plan.lowCount < QUAD_IRQ_CYCLES));
+	sei();
+
+	if(!quadEdge(irqOff)){
+		return;
+	}
+	quadDirty = false;
+	q = (uint16_t)plan.lowCount;
+	cs = plan.highRem;
+	flip = (plan.lowRem != quadDir);
+	quadDir = plan.lowRem;
+
+	if(cs != (TCCR1B & 7)){
+		TCCR1B = (1 << WGM12) | cs;
+		GTCCR = (1 << PSR10);
+		TCNT1 = 0;
+	}
+	OCR1A = 2 * q - 1;
+	OCR1B = flip ? 0xFFFF : q - 1;
+	if(flip){
+		if(!irqOff){
+			sei();
+		}
+		if(quadEdge(irqOff)){
+			OCR1B = q - 1;
+		}
+	}
+	sei();
+}
+
+/* Quadrature A/B from the timer1 compare hardware in CTC mode */
+void doQuad( void ){
+	uint16_t q = (uint16_t)plan.lowCount;
+
+#if FEATURE_SELFTEST
+	measStop();
+#endif
+	TMR_STOP();
+	TMR_CLR_INT();
+
+	/* Both outputs low, then both toggling. Starting TCNT1 at Q puts the
+	 * first A edge ahead of B, at 0 B leads. */
+	TCCR1B = 0;
+	TCCR1A = (1 << COM1A1) | (1 << COM1B1);
+	TCCR1C = (1 << FOC1A) | (1 << FOC1B);
+	TCCR1A = (1 << COM1A0) | (1 << COM1B0);
+	OCR1A = 2 * q - 1;
+	OCR1B = q - 1;
+	quadDir = plan.lowRem;
+	TCNT1 = quadDir ? 0 : q;
+	quadDirty = false;
+	quadB = 0;
+	quadPos = 0;
+	TIFR = (1 << OCF1A) | (1 << OCF1B);
+	if(quadCycles){
+		TIMSK |= (1 << OCIE1B);
+	}
+	GTCCR = (1 << PSR10);
+	TCCR1B = (1 << WGM12) | plan.highRem;
+
+	while(modeContinueFlag){
+		if(quadDirty){
+			quadUpdate();
+		}
+		TX_POLL();
+	}
+
+	TCCR1B = 0;
+	TCCR1A = 0;
+	TIMSK &= ~(1 << OCIE1B);
+}
+#endif
+
+#if FEATURE_PLL
+/* Compare B ISR of the PLL, schedules the edge after the one just made */
+static inline void pllIsr( void ){
+	uint16_t next = pllNext + pllQ;
+
+	pllErr += pllR;
+	if(pllErr >= pll2M){
+		pllErr -= pll2M;
+		next++;
+	}
+	pllNext = next;
+	if((int16_t)(next - TCNT1) < PLL_NEAR){
+		next = TCNT1 + PLL_NEAR;	/* held off too long, a late edge beats a lost one */
+	}
+	OCR1B = next;
+}
+
+/* Capture ISR of the PLL, every rising input edge */
+static inline void pllCapture( void ){
+	uint16_t stamp = ICR1;
+	uint16_t next;
+	uint8_t high;
+
+	if(pllCount == PLL_FIRST){
+		pllCount = 0;
+	}else{
+		pllSpan += (uint16_t)(stamp - pllLast);
+		pllCount++;
+	}
+	pllLast = stamp;
+	if(pllCount < pllN){
+		return;
+	}
+	pllCount = 0;
+	pllSpanDone = pllSpan;
+	pllSpanReady = true;
+	pllSpan = 0;
+	if(pllQ == 0){
+		return;
+	}
+
+	/* Anchor, the output rises at this input edge. A rising edge already made
+	 * was the prediction and the falling one is set from here, one still due
+	 * is made now. The first anchor starts the toggling. */
+	if(!(TIMSK & (1 << OCIE1B))){
+		TCCR1A = (1 << COM1B0);
+		TIMSK |= (1 << OCIE1B);
+	}
+	TIFR = (1 << OCF1B);	/* the next edge is scheduled here */
+	high = PINB & (1 << PB4);
+	if(TIFR & (1 << OCF1B)){
+		TIFR = (1 << OCF1B);
+		high = PINB & (1 << PB4);
+	}
+	if(high){
+		pllNext = stamp + pllQ;
+		pllErr = pllR;
+	}else{
+		pllNext = stamp;
+		pllErr = 0;
+	}
+	next = pllNext;
+	if((int16_t)(next - TCNT1) < PLL_NEAR){
+		next = TCNT1 + PLL_NEAR;
+	}
+	OCR1B = next;
+}
+
+/* M/N PLL, main() divides each captured span into output half periods */
+void doPll( void ){
+	uint32_t span;
+	uint32_t q;
+
+#if FEATURE_SELFTEST
+	measStop();
+#endif
+	TMR_STOP();
+	TMR_CLR_INT();
+
+	/* OC1B low until the first anchor sets it toggling */
+	TCCR1B = 0;
+	TCCR1A = (1 << COM1B1);
+	TCCR1C = (1 << FOC1B);
+	pllN = plan.highRem;
+	pll2M = 2 * plan.lowRem;
+	pllQ = 0;
+	pllCount = PLL_FIRST;
+	pllSpan = 0;
+	pllSpanReady = false;
+	TIFR = (1 << ICF1) | (1 << OCF1B);
+	TIMSK |= (1 << ICIE1);
+	TCCR1B = (1 << ICES1) | plan.lowCount;	/* normal mode, rising edges */
+
+	while(modeContinueFlag){
+		if(pllSpanReady){
+			cli();
+			span = pllSpanDone;
+			pllSpanReady = false;
+			sei();
+			q = span / pll2M;
+			if((q >= PLL_MIN) && (q < 0x8000)){
+				cli();
+				pllQ = q;
+				pllR = span - q * pll2M;
+				sei();
+			}
+		}
+		TX_POLL();
+	}
+
+	TCCR1B = 0;
+	TCCR1A = 0;
+	TIMSK &= ~((1 << ICIE1) | (1 << OCIE1B));
+}
+#endif
+
+
+#if FEATURE_PWM || FEATURE_STEPPER || FEATURE_QUADRATURE || FEATURE_PLL || FEATURE_DELAY
+ISR (TIMER1_COMPB_vect)
+{
+#if FEATURE_STEPPER
+	if(plan.mode == MODE_STEP){
+		stepIsr();
+		return;
+	}
+#endif
+#if FEATURE_QUADRATURE
+	if(plan.mode == MODE_QUAD){
+		quadIsr();
+		return;
+	}
+#endif
+#if FEATURE_PLL
+	if(plan.mode == MODE_PLL){
+		pllIsr();
+		return;
+	}
+#endif
+#if FEATURE_DELAY
+	if(plan.mode == MODE_DELAY){
+		if(delayArmed){
+			delayNext();
+		}
+		return;
+	}
+#endif
+#if FEATURE_PWM
+	pwmIsr();
+#endif
+}
+#endif
+
+#if FEATURE_EXT_CLOCK || FEATURE_SPREAD || FEATURE_POISSON || FEATURE_HOP
+ISR (TIMER1_COMPA_vect)
+{
+#if FEATURE_HOP
+	if(plan.mode == MODE_HOP){
+		hopIsr();
+		return;
+	}
+#endif
+#if FEATURE_SPREAD
+	if(plan.mode == MODE_SPREAD){
+		spreadIsr();
+		return;
+	}
+#endif
+#if FEATURE_POISSON
+	if(plan.mode == MODE_POISSON){
+		poissonIsr();
+		return;
+	}
+#endif
+#if FEATURE_EXT_CLOCK
+	extIsr();
+#endif
+}
+#endif
+
+#if FEATURE_SELFTEST || FEATURE_PLL || FEATURE_DELAY
+ISR (TIMER1_CAPT_vect)
+{
+#if FEATURE_PLL
+	if(plan.mode == MODE_PLL){
+		pllCapture();
+		return;
+	}
+#endif
+#if FEATURE_DELAY
+	if(plan.mode == MODE_DELAY){
+		delayCapture();
+		return;
+	}
+#endif
+#if FEATURE_SELFTEST
+	measCapture();
+#endif
+}
+#endif
+
+
+int main(void)
+{
+	init();
+
+    for(;;){    /* main event loop */
+    	modeContinueFlag = true;
+
+#if FEATURE_STATUS
+    	if(statusDue){
+    		statusDue = false;
+    		sendStatus();
+    	}
+#endif
+
+    	if(outState != OUT_RUNNING){
+    		doStop();
+    		continue;
+    	}
+
+    	/* Resume takes the same fixed path, the plan is already there */
+    	OUT_CLR();
+    	DDRB = 0xff;
+
+#if FEATURE_TOGGLE
+    	if(plan.mode == MODE_TOGGLE){
+    		/* PWM mode */
+    		doToggle();
+    		continue;
+    	}
+#endif
+#if FEATURE_EXT_CLOCK
+    	if(plan.mode == MODE_EXT_CLOCK){
+    		doExtClock();
+    		continue;
+    	}
+#endif
+#if FEATURE_PRBS
+    	if(plan.mode == MODE_PRBS){
+    		doPrbs();
+    		continue;
+    	}
+#endif
+#if FEATURE_LINECODE
+    	if(plan.mode == MODE_CODE){
+    		doCode();
+    		continue;
+    	}
+#endif
+#if FEATURE_PWM
+    	if(plan.mode == MODE_PWM){
+    		doPwm();
+    		continue;
+    	}
+#endif
+#if FEATURE_STEPPER
+    	if(plan.mode == MODE_STEP){
+    		doStep();
+    		continue;
+    	}
+#endif
+#if FEATURE_QUADRATURE
+    	if(plan.mode == MODE_QUAD){
+    		doQuad();
+    		continue;
+    	}
+#endif
+#if FEATURE_PLL
+    	if(plan.mode == MODE_PLL){
+    		doPll();
+    		continue;
+    	}
+#endif
+#if FEATURE_BINARY
+    	if(plan.mode == MODE_BINARY){
+    		doBinary();
+    		continue;
+    	}
+#endif
+#if FEATURE_PDM
+    	if(plan.mode == MODE_PDM){
+    		doPdm();
+    		continue;
+    	}
+#endif
+#if FEATURE_SPREAD
+    	if(plan.mode == MODE_SPREAD){
+    		doSpread();
+    		continue;
+    	}
+#endif
+#if FEATURE_POISSON
+    	if(plan.mode == MODE_POISSON){
+    		doPoisson();
+    		continue;
+    	}
+#endif
+#if FEATURE_DOUBLE_PULSE
+    	if(plan.mode == MODE_SHOT){
+    		doShot();
+    		continue;
+    	}
+#endif
+#if FEATURE_DELAY
+    	if(plan.mode == MODE_DELAY){
+    		doDelay();
+    		continue;
+    	}
+#endif
+#if FEATURE_HOP
+    	if(plan.mode == MODE_HOP){
+    		doHop();
+    		continue;
+    	}
+#endif
+    	/* count mode */
+    	doCounting();
+    }
+    return 0;
+}
+
@@ -0,0 +1,18 @@
+/* Host stand-in for <avr/eeprom.h>, EEMEM variables are ordinary memory */
+
+#ifndef __stub_eeprom_h_included__
+#define __stub_eeprom_h_included__
+
+#include <stdint.h>
+#include <string.h>
+
+#define EEMEM
+
+static inline uint8_t eeprom_read_byte(const uint8_t *p){ return *p; }
+static inline void eeprom_read_block(void *d, const void *s, size_t n){ memcpy(d, s, n); }
+static inline void eeprom_write_byte(uint8_t *p, uint8_t v){ *p = v; }
+static inline void eeprom_update_byte(uint8_t *p, uint8_t v){ *p = v; }
+static inline void eeprom_update_block(const void *s, void *d, size_t n){ memcpy(d, s, n); }
+#define eeprom_busy_wait()	do{ }while(0)
+
+#endif
@@ -0,0 +1,10 @@
+/* Host stand-in for <avr/interrupt.h>, a test calls the handlers directly */
+
+#ifndef __stub_interrupt_h_included__
+#define __stub_interrupt_h_included__
+
+#define ISR(vector, ...)	void vector(void); void vector(void)
+#define sei()				do{ }while(0)
+#define cli()				do{ }while(0)
+
+#endif
@@ -0,0 +1,46 @@
+/* Host stand-in for <avr/io.h>: the ATtiny2313 registers the generator uses
+ * as plain variables, bit numbers as in the datasheet. Every test is a single
+ * translation unit, so the registers are defined here. */
+
+#ifndef __stub_io_h_included__
+#define __stub_io_h_included__
+
+#include <stdint.h>
+
+#define E2END		(127)
+#define _SFR_IO_ADDR(r)	(0)
+
+volatile uint8_t SREG, ACSR, GTCCR, WDTCSR, MCUCR, GIMSK, GPIOR0, GPIOR1, GPIOR2;
+volatile uint8_t DDRB, PORTB, PINB, DDRD, PORTD, PIND;
+volatile uint8_t UBRRL, UBRRH, UCSRA, UCSRB, UCSRC, UDR;
+volatile uint8_t TCCR0A, TCCR0B, OCR0A, OCR0B, TCNT0, TIMSK, TIFR;
+volatile uint8_t TCCR1A, TCCR1B, TCCR1C;
+volatile uint16_t OCR1A, OCR1B, ICR1, TCNT1;
+volatile uint8_t EECR, EEAR, EEDR;
+
+/* UCSRA, UCSRB */
+enum{ MPCM, U2X, UPE, DOR, FE, UDRE, TXC, RXC };
+enum{ TXB8, RXB8, UCSZ2, TXEN, RXEN, UDRIE, TXCIE, RXCIE };
+/* TCCR0A, TCCR0B */
+enum{ WGM00, WGM01, COM0B0 = 4, COM0B1, COM0A0, COM0A1 };
+enum{ CS00, CS01, CS02, WGM02, FOC0B = 6, FOC0A };
+/* TCCR1A, TCCR1B, TCCR1C */
+enum{ WGM10, WGM11, COM1B0 = 4, COM1B1, COM1A0, COM1A1 };
+enum{ CS10, CS11, CS12, WGM12, WGM13, ICES1 = 6, ICNC1 };
+enum{ FOC1B = 6, FOC1A };
+/* TIMSK, TIFR */
+enum{ OCIE0A, TOIE0, OCIE0B, ICIE1, OCIE1B = 5, OCIE1A, TOIE1 };
+enum{ OCF0A, TOV0, OCF0B, ICF1, OCF1B = 5, OCF1A, TOV1 };
+/* EECR, WDTCSR, GTCCR, ACSR */
+enum{ EERE, EEPE, EEMPE, EERIE, EEPM0, EEPM1 };
+enum{ WDP0, WDP1, WDP2, WDE, WDCE, WDP3, WDIE, WDIF };
+enum{ PSR10 };
+enum{ ACD = 7 };
+/* GIMSK, MCUCR */
+enum{ PCIE = 5, INT0, INT1 };
+enum{ ISC00, ISC01, ISC10, ISC11, SM0, SE, SM1, PUD };
+/* PORTB, PORTD */
+enum{ PB0, PB1, PB2, PB3, PB4, PB5, PB6, PB7 };
+enum{ PD0, PD1, PD2, PD3, PD4, PD5, PD6 };
+
+#endif
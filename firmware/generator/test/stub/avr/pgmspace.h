@@ -0,0 +1,15 @@
+/* Host stand-in for <avr/pgmspace.h>, flash is ordinary memory */
+
+#ifndef __stub_pgmspace_h_included__
+#define __stub_pgmspace_h_included__
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define pgm_read_byte(a)	(*(const uint8_t *)(a))
+#define pgm_read_word(a)	(*(const uint16_t *)(a))
+#define pgm_read_dword(a)	(*(const uint32_t *)(a))
+#define memcpy_P(d, s, n)	memcpy((d), (s), (n))
+
+#endif
@@ -0,0 +1,6 @@
+/* Host stand-in for <avr/sleep.h> */
+
+#define sleep_mode()		do{ }while(0)
+#define sleep_enable()		do{ }while(0)
+#define sleep_disable()		do{ }while(0)
+#define sleep_cpu()			do{ }while(0)
@@ -0,0 +1,3 @@
+/* Host stand-in for <avr/wdt.h> */
+
+#define wdt_reset()		do{ }while(0)
@@ -0,0 +1,5 @@
+/* Host stand-in for <util/atomic.h>, nothing interrupts a test */
+
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_FORCEON
+#define ATOMIC_BLOCK(type)	for(uint8_t __done = 0; !__done; __done = 1)
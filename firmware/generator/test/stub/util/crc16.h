@@ -0,0 +1,19 @@
+/* Host stand-in for <util/crc16.h>, the avr-libc reference C code */
+
+#ifndef __stub_crc16_h_included__
+#define __stub_crc16_h_included__
+
+#include <stdint.h>
+
+/* CRC-8 CCITT, polynomial x^8 + x^2 + x + 1 (0x07), MSB first */
+static inline uint8_t _crc8_ccitt_update(uint8_t crc, uint8_t data){
+	uint8_t i;
+
+	crc ^= data;
+	for(i = 0; i < 8; i++){
+		crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+	}
+	return crc;
+}
+
+#endif
@@ -0,0 +1,4 @@
+/* Host stand-in for <util/delay.h> */
+
+#define _delay_us(us)		do{ }while(0)
+#define _delay_ms(ms)		do{ }while(0)
@@ -0,0 +1,24 @@
+/* Host test harness: CHECK reports a failed condition and counts it, a test's
+ * main returns TEST_DONE() as the exit status. Included before main.c, so the
+ * AVR asm statements (renamed HOSTASM by the Makefile) compile to nothing. */
+
+#ifndef __test_h_included__
+#define __test_h_included__
+
+#include <stdio.h>
+
+#define HOSTASM(...)	((void)0)
+
+static unsigned testFailures;
+
+#define CHECK(cond)	do{ \
+		if(!(cond)){ \
+			printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			testFailures++; \
+		} \
+	}while(0)
+
+#define TEST_DONE()	(printf("%-16s %s\n", __FILE__, testFailures ? "FAILED" : "ok"), \
+		testFailures != 0)
+
+#endif
@@ -0,0 +1,261 @@
+/* Command framing: SYNC, length, command and arguments, crc8, with SYNC and
+ * ESC escaped. Frames go byte by byte through the RX ISR; a good frame must
+ * always be taken and a damaged one never, whatever came before it. Replies
+ * go out framed the same way. */
+
+#include "test.h"
+#define main generator_main
+#include "main.c"
+#undef main
+
+static uint32_t seed = 1;
+
+static uint32_t rnd( void ){
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+static void rxByte(uint8_t data, uint8_t flags){
+	UCSRA = flags | (1 << UDRE);
+	UDR = data;
+	USART_RX_vect();
+}
+
+static void rxEscaped(uint8_t data){
+	if((data == LINK_SYNC) || (data == LINK_ESC)){
+		rxByte(LINK_ESC, 0);
+		data ^= 0x20;
+	}
+	rxByte(data, 0);
+}
+
+/* Length, command, arguments and crc as on the link, 'flip' xors one bit */
+static void sendFrame(uint8_t cmd, const uint8_t *args, uint8_t n, uint8_t flipAt, uint8_t flip){
+	uint8_t frame[RX_SIZE + 2];
+	uint8_t crc = 0;
+	uint8_t i;
+
+	frame[0] = n + 1;
+	frame[1] = cmd;
+	memcpy(&frame[2], args, n);
+	for(i = 0; i < n + 2; i++){
+		crc = _crc8_ccitt_update(crc, frame[i]);
+	}
+	frame[n + 2] = crc;
+	if(flipAt < n + 3){
+		frame[flipAt] ^= flip;
+	}
+
+	rxByte(LINK_SYNC, 0);
+	for(i = 0; i < n + 3; i++){
+		rxEscaped(frame[i]);
+	}
+}
+
+static void sendPause(uint32_t value, uint8_t flipAt, uint8_t flip){
+	uint8_t args[4] = { value >> 24, value >> 16, value >> 8, value };
+
+	sendFrame(CMD_SET_PAUSE, args, 4, flipAt, flip);
+}
+
+/* Every byte value, SYNC and ESC included, in every argument position */
+static void escapes( void ){
+	uint32_t v;
+	uint8_t pos;
+
+	for(pos = 0; pos < 4; pos++){
+		for(v = 0; v < 256; v++){
+			uint32_t value = (0x11223300 ^ (v << (8 * pos))) & MAX_LEN;
+
+			pauseLen = 0;
+			sendPause(value, 0xFF, 0);
+			CHECK(pauseLen == value);
+		}
+	}
+}
+
+/* Any single bit error in length, command, arguments or crc is dropped */
+static void bitErrors( void ){
+	uint8_t at, bit;
+#if FEATURE_STATUS
+	uint8_t errors = rxFrameErrors;
+#endif
+
+	for(at = 0; at < 7; at++){
+		for(bit = 0; bit < 8; bit++){
+			pauseLen = 1234;
+			sendPause(5678, at, 1 << bit);
+			CHECK(pauseLen == 1234);
+			/* and the link is in step again for the next frame */
+			sendPause(4321, 0xFF, 0);
+			CHECK(pauseLen == 4321);
+		}
+	}
+#if FEATURE_STATUS
+	CHECK(rxFrameErrors != errors);
+#endif
+}
+
+/* Bad lengths and argument counts never reach the commands */
+static void badFrames( void ){
+	uint8_t args[RX_SIZE] = { 0, 0, 0x10, 0 };
+	uint8_t i;
+
+	pauseLen = 1;
+	sendFrame(CMD_SET_PAUSE, args, 1, 0xFF, 0);	/* too short for the command */
+	sendFrame(CMD_SET_PAUSE, args, 4, 0, 4);		/* length 1, the crc is off */
+	sendFrame(CMD_UNKNOWN, args, 4, 0xFF, 0);
+	CHECK(pauseLen == 1);
+
+	/* length byte 0 and past RX_SIZE, then a long run of data */
+	rxByte(LINK_SYNC, 0);
+	rxByte(0, 0);
+	rxByte(LINK_SYNC, 0);
+	rxByte(RX_SIZE + 1, 0);
+	for(i = 0; i < 200; i++){
+		rxByte(CMD_SET_PAUSE, 0);
+	}
+	CHECK(rx_index <= RX_SIZE);
+	CHECK(pauseLen == 1);
+	sendPause(99, 0xFF, 0);
+	CHECK(pauseLen == 99);
+}
+
+/* A framing error (break) drops the frame it hits */
+static void breakMidFrame( void ){
+	pauseLen = 7;
+	rxByte(LINK_SYNC, 0);
+	rxByte(5, 0);
+	rxByte(CMD_SET_PAUSE, 0);
+	rxByte(0, 1 << FE);
+	rxByte(0, 0);
+	rxByte(0, 0);
+	rxByte(8, 0);
+	rxByte(0, 0);
+	CHECK(pauseLen == 7);
+	sendPause(8, 0xFF, 0);
+	CHECK(pauseLen == 8);
+}
+
+#if FEATURE_FAST_LINK
+/* Only a framing error with RXD still low a frame later (a break) drops the
+ * link to 9600, noise leaves the rate the bridge still uses */
+static void breakOrNoise( void ){
+	linkSet(LINK_38400);
+	PIND = (1 << PD0);
+	rxByte(0, 1 << FE);
+	CHECK(linkRate == LINK_38400);
+	PIND = 0;
+	rxByte(0, 1 << FE);
+	CHECK(linkRate == LINK_9600);
+	PIND = (1 << PD0);
+}
+#endif
+
+/* Back to back frames with random damage, truncation and line noise between
+ * them: every intact frame is taken, in order, none of the others. */
+static void stress( void ){
+	uint32_t n, value, expect = 0;
+	uint8_t i, noise;
+
+	pauseLen = 0;
+	for(n = 0; n < 200000; n++){
+		value = rnd() & MAX_LEN;
+		switch(rnd() & 7){
+		case 0:		/* one bit flipped */
+			sendPause(value, rnd() % 7, 1 << (rnd() & 7));
+			break;
+		case 1:		/* cut short, the next SYNC starts over */
+			rxByte(LINK_SYNC, 0);
+			for(i = rnd() % 7; i; i--){
+				rxByte(rnd(), 0);
+			}
+			break;
+		case 2:		/* noise without a SYNC after a complete frame */
+			sendPause(value, 0xFF, 0);
+			expect = value;
+			for(noise = rnd() & 15; noise; noise--){
+				uint8_t b = rnd();
+
+				if(b != LINK_SYNC){
+					rxByte(b, 0);
+				}
+			}
+			break;
+		default:
+			sendPause(value, 0xFF, 0);
+			expect = value;
+			break;
+		}
+		if(pauseLen != expect){
+			CHECK(pauseLen == expect);
+			break;
+		}
+	}
+}
+
+#if HAVE_REPLY
+/* Every payload byte value, each frame decoded as the host would: no SYNC
+ * after the first byte, the escapes undone and the crc8 right */
+static void replies( void ){
+	uint8_t payload[sizeof(reply_t)];
+	uint8_t out[2 * sizeof(txFrame)];
+	uint8_t frame[sizeof(txFrame)];
+	uint8_t n, m, i, crc, v = 0;
+	bool ok = true;
+
+	do{
+		for(i = 0; i < sizeof(payload); i++){
+			payload[i] = v + i * 0x3F;
+		}
+		payload[v % sizeof(payload)] = (v & 1) ? LINK_SYNC : LINK_ESC;
+		txStart(TX_JITTER - (v & 3), payload, sizeof(payload));
+
+		n = 0;
+		UCSRA = (1 << UDRE);
+		while(txLeft && (n < sizeof(out))){
+			TX_POLL();
+			out[n++] = UDR;
+		}
+		ok = ok && (txLeft == 0) && (out[0] == LINK_SYNC);
+
+		for(i = 1, m = 0; (i < n) && (m < sizeof(frame)); i++){
+			ok = ok && (out[i] != LINK_SYNC);
+			if(out[i] == LINK_ESC){
+				frame[m++] = out[++i] ^ 0x20;
+			}else{
+				frame[m++] = out[i];
+			}
+		}
+		ok = ok && (m == sizeof(payload) + 3);
+		ok = ok && (frame[0] == TX_JITTER - (v & 3)) && (frame[1] == sizeof(payload));
+		ok = ok && (memcmp(&frame[2], payload, sizeof(payload)) == 0);
+		for(i = 0, crc = 0; i < m - 1; i++){
+			crc = _crc8_ccitt_update(crc, frame[i]);
+		}
+		ok = ok && (crc == frame[m - 1]);
+	}while(++v);
+	CHECK(ok);
+}
+#endif
+
+int main( void ){
+	linkSet(LINK_9600);
+	timebase = TIMEBASE_INTERNAL;
+	rxLen = RX_HUNT;
+
+	escapes();
+	bitErrors();
+	badFrames();
+	breakMidFrame();
+#if FEATURE_FAST_LINK
+	breakOrNoise();
+#endif
+	stress();
+#if HAVE_REPLY
+	replies();
+#endif
+	return TEST_DONE();
+}
@@ -0,0 +1,264 @@
+/* Preset log: stores written through the EE_READY ISR come back from the
+ * scan and the boot lookup after a reset, across sequence number wrap, a
+ * reset in the middle of a write leaves the old record, and a store arriving
+ * while another one is still pending is refused instead of saving a later
+ * plan. A recall during a write is left to the EE_READY ISR. */
+
+#include "test.h"
+#include <avr/io.h>
+#include <stdbool.h>
+
+/* EERE loads EEDR from the cell at EEAR, EEPE writes it back at the next
+ * access, when the ISR has returned, or later with simBusy */
+#define EECR	(*simEecr())
+#define EEDR	(*simEedr())
+
+static uint8_t *simLog, *simBoot;	/* presetLog and bootSlot */
+static uint8_t simCr, simDr;
+static bool simBusy;
+
+/* EEAR holds the low address byte, as on the chip */
+static uint8_t *simCell( void ){
+	if(EEAR == (uint8_t)(uintptr_t)simBoot){
+		return simBoot;
+	}
+	return simLog + (uint8_t)(EEAR - (uint8_t)(uintptr_t)simLog);
+}
+
+static void simCommit( void ){
+	if((simCr & (1 << EEPE)) && !simBusy){
+		*simCell() = simDr;
+		simCr &= ~((1 << EEPE) | (1 << EEMPE));
+	}
+}
+
+static volatile uint8_t *simEecr( void ){
+	simCommit();
+	return &simCr;
+}
+
+static volatile uint8_t *simEedr( void ){
+	if(simCr & (1 << EERE)){
+		simDr = *simCell();
+		simCr &= ~(1 << EERE);
+	}
+	return &simDr;
+}
+
+#define main generator_main
+#include "main.c"
+#undef main
+
+static uint32_t seed = 1;
+
+static uint32_t rnd( void ){
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+static plan_t saved[PRESET_COUNT];
+static bool used[PRESET_COUNT];
+
+static void setPlan(uint32_t n){
+	memset((void *)&plan, 0, sizeof(plan));
+	plan.mode = MODE_COUNT_LONG;
+	plan.lowCount = n;
+	plan.highCount = ~n;
+	plan.lowRem = n >> 8;
+	plan.highRem = n >> 16;
+}
+
+/* EE_READY interrupts until the queue is empty, or only 'n' of them */
+static void drain(uint32_t n){
+	while((simCr & (1 << EERIE)) && n--){
+		simCommit();
+		EE_READY_vect();
+	}
+	simCommit();
+}
+
+static bool findOk = true;
+
+/* Power up: RAM state lost, the boot lookup of every slot agrees with the
+ * log scan that follows */
+static void reset( void ){
+	uint8_t found[PRESET_COUNT];
+	uint8_t slot;
+
+	simCr = 0;
+	eeJobs = 0;
+	eeSlot = LOG_NONE;
+	eeLeft = 0;
+	eeRecall = LOG_NONE;
+	logScanPos = LOG_NONE;
+	for(slot = 0; slot < PRESET_COUNT; slot++){
+		found[slot] = logFind(slot);
+	}
+	logScan();
+	drain(0xFFFFFFFF);
+	findOk = findOk && (memcmp(found, logPos, sizeof(found)) == 0);
+}
+
+/* Every slot recalls the plan last stored in it, or nothing */
+static bool recalls( void ){
+	uint8_t slot;
+	bool ok = true;
+
+	for(slot = 0; slot < PRESET_COUNT; slot++){
+		setPlan(0xDEAD);
+		ok = ok && (loadPlan(slot) == used[slot]);
+		if(used[slot]){
+			ok = ok && (memcmp((const void *)&plan, &saved[slot], sizeof(plan_t)) == 0);
+		}
+	}
+	return ok;
+}
+
+static bool store(uint8_t slot, uint32_t n){
+	setPlan(n);
+	if(!storePlan(slot)){
+		return false;
+	}
+	saved[slot] = plan;
+	used[slot] = true;
+	return true;
+}
+
+/* Many times around the 8 bit sequence number, a reset after every store */
+static void wrap( void ){
+	uint32_t i;
+	bool ok = true;
+
+	for(i = 0; i < 2000; i++){
+		ok = ok && store(rnd() % PRESET_COUNT, i);
+		drain(0xFFFFFFFF);
+		reset();
+		ok = ok && recalls();
+	}
+	CHECK(ok);
+}
+
+/* A reset after every number of bytes of a store: the slot recalls the old
+ * plan or the new one, never a mix, the new one for sure once the crc is in,
+ * and the next store goes on from there. A record cut short still passes
+ * the crc 1 time in 256 when its unwritten bytes hold the same plan. */
+static void torn( void ){
+	uint32_t n = 0x10000;
+	uint8_t slot, cut;
+	plan_t before;
+	bool had, ok = true;
+
+	for(slot = 0; slot < PRESET_COUNT; slot++){
+		for(cut = 0; cut <= sizeof(record_t) + 1; cut++){
+			before = saved[slot];
+			had = used[slot];
+			ok = ok && store(slot, n++);
+			drain(cut);
+			reset();
+			if((cut < sizeof(record_t)) && !recalls()){
+				saved[slot] = before;
+				used[slot] = had;
+			}
+			ok = ok && recalls();
+
+			/* and a whole one over it */
+			ok = ok && store(slot, n++);
+			drain(0xFFFFFFFF);
+			reset();
+			ok = ok && recalls();
+		}
+	}
+	CHECK(ok);
+}
+
+/* set A; store 0; set B; store 1; set C while the first write runs */
+static void busy( void ){
+	uint8_t n;
+
+	CHECK(store(0, 0xA));
+	drain(3);
+	CHECK(!store(1, 0xB));
+	setPlan(0xC);
+	drain(0xFFFFFFFF);
+	reset();
+	CHECK(recalls());
+
+	/* the boot slot is written apart and does not block a store */
+	storeBootSlot(2);
+	CHECK(store(1, 0xB));
+	drain(0xFFFFFFFF);
+	CHECK(eeprom_read_byte(&bootSlot) == 2);
+	reset();
+	CHECK(recalls());
+
+	/* the same slot twice in a row */
+	CHECK(store(3, 0x33));
+	CHECK(!store(3, 0x34));
+	for(n = 0; (n < 100) && !store(3, 0x35); n++){
+		drain(1);
+	}
+	drain(0xFFFFFFFF);
+	reset();
+	CHECK(recalls());
+}
+
+/* A recall while a byte is being written: the RX ISR goes on, the EE_READY
+ * ISR recalls once the byte is done, unless a command restarted the engine
+ * meanwhile. The same before the log is scanned. */
+static void recall( void ){
+	CHECK(store(0, 0x77));
+	drain(0xFFFFFFFF);
+
+	CHECK(store(1, 0x78));
+	simBusy = true;
+	drain(1);
+	CHECK(simCr & (1 << EEPE));
+	setPlan(0xDEAD);
+	modeContinueFlag = true;
+	recallPlan(0);
+	CHECK((plan.lowCount == 0xDEAD) && modeContinueFlag);
+	simBusy = false;
+	drain(1);
+	CHECK((plan.lowCount == 0x77) && !modeContinueFlag);
+
+	simBusy = true;
+	drain(1);
+	recallPlan(0);
+	setPlan(0xBEEF);
+	restartEngine();
+	simBusy = false;
+	drain(0xFFFFFFFF);
+	CHECK(plan.lowCount == 0xBEEF);
+
+	setPlan(0xDEAD);
+	recallPlan(1);
+	CHECK(plan.lowCount == 0x78);
+	reset();
+	CHECK(recalls());
+
+	/* the first recall after a reset waits for the scan */
+	logScanPos = LOG_NONE;
+	setPlan(0xDEAD);
+	recallPlan(1);
+	CHECK((plan.lowCount == 0xDEAD) && (simCr & (1 << EERIE)));
+	drain(0xFFFFFFFF);
+	CHECK(plan.lowCount == 0x78);
+}
+
+int main( void ){
+	simLog = (uint8_t *)presetLog;
+	simBoot = &bootSlot;
+	CHECK((uint8_t)(simBoot - simLog) >= sizeof(presetLog));
+	memset(presetLog, 0xFF, sizeof(presetLog));
+	reset();
+	CHECK(recalls());
+
+	busy();
+	recall();
+	wrap();
+	torn();
+	CHECK(findOk);
+	return TEST_DONE();
+}
@@ -0,0 +1,141 @@
+/* makePlan and planLen: a duration divided into timer0 counts comes back
+ * unchanged, so single parameter changes work after a preset recall, and the
+ * preset crc catches a changed record. The external divider is exact or
+ * refused. */
+
+#include "test.h"
+#define main generator_main
+#include "main.c"
+#undef main
+
+static const uint32_t lens[] = {
+	0, 1, 7, 8, 14, 15, 16, 124, 125, 126, 249, 250, 251, 10000,
+	123456, 0x00FFFFFF, MAX_LEN - 1, MAX_LEN,
+};
+
+/* Every length, both phases, through the RX path entry points */
+static void roundTrip( void ){
+	uint8_t i, j;
+
+	for(i = 0; i < sizeof(lens) / sizeof(lens[0]); i++){
+		for(j = 0; j < sizeof(lens) / sizeof(lens[0]); j++){
+			timebase = TIMEBASE_INTERNAL;
+			plan.mode = MODE_UNKNOWN;
+			pauseLen = lens[i];
+			pulseLen = lens[j];
+			makePlan(PHASE_LOW | PHASE_HIGH);
+			if(plan.mode == MODE_TOGGLE){
+				CHECK(pauseLen + pulseLen < 15);
+				CHECK(plan.lowRem == (pauseLen + pulseLen) / 2);
+				continue;
+			}
+			CHECK(plan.mode >= MODE_COUNT_SHORT && plan.mode <= MODE_COUNT_LONG);
+			CHECK(plan.lowRem < TMR0_MAX_COUNT && plan.highRem < TMR0_MAX_COUNT);
+			CHECK(planLen(plan.lowCount, plan.lowRem) == lens[i]);
+			CHECK(planLen(plan.highCount, plan.highRem) == lens[j]);
+			CHECK((plan.lowCount == 0) == (plan.mode == MODE_COUNT_SHORT
+				|| plan.mode == MODE_COUNT_LONG_HIGH));
+			CHECK((plan.highCount == 0) == (plan.mode == MODE_COUNT_SHORT
+				|| plan.mode == MODE_COUNT_LONG_LOW));
+
+			/* a recalled plan gives the lengths back */
+			pauseLen = 0;
+			pulseLen = 0;
+			applyPlan();
+			CHECK(pauseLen == lens[i]);
+			CHECK(pulseLen == lens[j]);
+		}
+	}
+}
+
+/* A single phase change keeps the other phase of the plan */
+static void singlePhase( void ){
+	timebase = TIMEBASE_INTERNAL;
+	plan.mode = MODE_UNKNOWN;
+	pauseLen = 10000;
+	pulseLen = 30000;
+	makePlan(PHASE_LOW | PHASE_HIGH);
+
+	pauseLen = 777;
+	pulseLen = 1;		/* ignored, only the low phase is divided */
+	makePlan(PHASE_LOW);
+	CHECK(planLen(plan.lowCount, plan.lowRem) == 777);
+	CHECK(planLen(plan.highCount, plan.highRem) == 30000);
+}
+
+#if FEATURE_PRESETS
+/* The crc covers every byte of the record and the record version */
+static void presetCrc( void ){
+	record_t r;
+	uint8_t *data = (uint8_t *)&r;
+	uint8_t i, bit;
+
+	memset(&r, 0, sizeof(r));
+	r.seq = 3;
+	r.slot = 1;
+	r.plan.mode = MODE_COUNT_LONG;
+	r.plan.lowCount = 40;
+	r.plan.highCount = 80;
+	r.crc = recordCrc(&r);
+	for(i = 0; i < offsetof(record_t, crc); i++){
+		for(bit = 0; bit < 8; bit++){
+			data[i] ^= 1 << bit;
+			CHECK(recordCrc(&r) != r.crc);
+			data[i] ^= 1 << bit;
+		}
+	}
+	CHECK(recordCrc(&r) == r.crc);
+}
+#endif
+
+#if FEATURE_EXT_CLOCK
+static void divide(uint32_t n){
+	rx_buf[0] = CMD_EXT_DIVIDE;
+	rx_buf[1] = n >> 24;
+	rx_buf[2] = n >> 16;
+	rx_buf[3] = n >> 8;
+	rx_buf[4] = n;
+	rx_index = 5;
+	check_command();
+}
+
+/* 09 divides by N exactly or leaves the plan alone, phases from 00 and 01 too
+ * short for the ISR come back lengthened */
+static void extDivide( void ){
+	static const uint32_t ok[] = { 2, 4, 64, 65, 67, 1001, 131072, 131073, 131074, MAX_LEN };
+	static const uint32_t bad[] = { 0, 1, 3, 31, 63, MAX_LEN + 1, 0xFFFFFFFF };
+	uint8_t i;
+
+	for(i = 0; i < sizeof(ok) / sizeof(ok[0]); i++){
+		divide(ok[i]);
+		CHECK(plan.mode == MODE_EXT_CLOCK);
+		CHECK(plan.lowCount + plan.highCount == ok[i]);
+		CHECK(extPlain(plan.lowCount, plan.highCount)
+			|| ((plan.lowCount >= EXT_MIN_TICKS) && (plan.highCount >= EXT_MIN_TICKS)));
+	}
+	for(i = 0; i < sizeof(bad) / sizeof(bad[0]); i++){
+		divide(bad[i]);
+		CHECK((plan.mode == MODE_EXT_CLOCK) && (plan.lowCount + plan.highCount == MAX_LEN));
+	}
+
+	pauseLen = 5;
+	makePlan(PHASE_LOW);
+	CHECK((plan.lowCount == EXT_MIN_TICKS) && (plan.highCount == MAX_LEN - (MAX_LEN >> 1)));
+	pulseLen = 5;
+	makePlan(PHASE_HIGH);
+	CHECK((plan.lowCount == 5) && (plan.highCount == 5));
+	timebase = TIMEBASE_INTERNAL;
+}
+#endif
+
+int main( void ){
+	roundTrip();
+	singlePhase();
+#if FEATURE_PRESETS
+	presetCrc();
+#endif
+#if FEATURE_EXT_CLOCK
+	extDivide();
+#endif
+	return TEST_DONE();
+}
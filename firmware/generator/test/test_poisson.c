@@ -0,0 +1,77 @@
+/* Poisson gaps: the LFSR visits every state, the inverse CDF table has mean 1
+ * and the gaps drawn by the ISR over a full LFSR period are exponential. */
+
+#include "test.h"
+#include <math.h>
+#define main generator_main
+#include "main.c"
+#undef main
+
+/* 65535 steps back to the start, so 65535 draws of 8 steps see every state */
+static void lfsrPeriod( void ){
+	uint16_t s = 1;
+	uint32_t n = 0;
+
+	do{
+		s = (s >> 1) ^ ((s & 1) ? LFSR_POLY : 0);
+		n++;
+	}while((s != 1) && (n < 0x10000));
+	CHECK(n == 0xFFFF);
+
+	n = 0;
+	do{
+		s = lfsrByte(s);
+		n++;
+	}while((s != 1) && (n < 0x10000));
+	CHECK(n == 0xFFFF);
+}
+
+/* A draw is a table bin, or the tail plus a new draw, so the mean E is
+ * (sum + TAIL + E) / 128 and E is one mean for sum + TAIL = 127 means */
+static void tableMean( void ){
+	uint32_t sum = POISSON_TAIL;
+	uint8_t u;
+
+	for(u = 0; u < POISSON_BINS - 1; u++){
+		sum += pgm_read_word(&poissonCdf[u]);
+		if(u){
+			CHECK(pgm_read_word(&poissonCdf[u]) >= pgm_read_word(&poissonCdf[u - 1]));
+		}
+	}
+	CHECK(sum == (POISSON_BINS - 1) * 256UL);
+}
+
+/* Mean, P(gap > k means) against e^-k, and no gap past the cap */
+static void draws(uint16_t mean){
+	uint32_t n, over1 = 0, over3 = 0, over6 = 0;
+	double total = 0, gap;
+	const uint32_t draws = 0xFFFF;
+
+	poissonMean = mean;
+	poissonPulse = 1;
+	poissonMax = 0xFFFF - poissonPulse;
+	poissonLfsr = 1;
+	for(n = 0; n < draws; n++){
+		poissonIsr();
+		gap = OCR1A + 1 - poissonPulse;
+		CHECK(gap >= 1);
+		CHECK(gap <= (double)mean * POISSON_CAP / 256 + 1);
+		total += gap;
+		over1 += gap > mean;
+		over3 += gap > 3.0 * mean;
+		over6 += gap > 6.0 * mean;
+	}
+	CHECK(fabs(total / draws / mean - 1) < 0.01);
+	CHECK(fabs((double)over1 / draws - exp(-1)) < 0.01);
+	CHECK(fabs((double)over3 / draws - exp(-3)) < 0.005);
+	CHECK(fabs((double)over6 / draws - exp(-6)) < 0.002);
+}
+
+int main( void ){
+	lfsrPeriod();
+	tableMean();
+	draws(100);
+	draws(1000);
+	draws(POISSON_MEAN_MAX);
+	return TEST_DONE();
+}
@@ -0,0 +1,60 @@
+/* PRBS7 to PRBS31: from the all ones seed the Galois LFSR of each mask runs
+ * through all 2^n - 1 non zero states before it repeats, and the bit stream
+ * is the x^n + x^a + 1 sequence. PRBS31 takes a few seconds. */
+
+#include "test.h"
+#define main generator_main
+#include "main.c"
+#undef main
+
+static const uint8_t prbsOrder[PRBS_UNKNOWN] = { 7, 15, 23, 31 };
+static const uint8_t prbsTap[PRBS_UNKNOWN] = { 6, 14, 18, 28 };
+
+static void period(uint8_t poly){
+	uint32_t mask = pgm_read_dword(&prbsMask[poly]);
+	uint32_t ones = pgm_read_dword(&prbsAllOnes[poly]);
+	uint32_t s = ones;
+	uint32_t n = 0;
+
+	CHECK(ones == (1UL << prbsOrder[poly]) - 1);
+	do{
+		s = PRBS_STEP(s, mask);
+		n++;
+		CHECK(s != 0);
+		if(s == 0){
+			return;
+		}
+	}while((s != ones) && (n <= ones));
+	CHECK(n == ones);
+}
+
+/* b[k] = b[k - n] ^ b[k - a], one of the two equivalent tap pairs */
+static void recurrence(uint8_t poly){
+	uint32_t mask = pgm_read_dword(&prbsMask[poly]);
+	uint32_t s = pgm_read_dword(&prbsAllOnes[poly]);
+	uint8_t n = prbsOrder[poly];
+	uint8_t a = prbsTap[poly];
+	uint8_t bits[512];
+	uint16_t k;
+	bool sum = true, diff = true;
+
+	for(k = 0; k < sizeof(bits); k++){
+		bits[k] = s & 1;
+		s = PRBS_STEP(s, mask);
+	}
+	for(k = n; k < sizeof(bits); k++){
+		sum = sum && (bits[k] == (bits[k - n] ^ bits[k - n + a]));
+		diff = diff && (bits[k] == (bits[k - n] ^ bits[k - a]));
+	}
+	CHECK(sum || diff);
+}
+
+int main( void ){
+	uint8_t poly;
+
+	for(poly = 0; poly < PRBS_UNKNOWN; poly++){
+		recurrence(poly);
+		period(poly);
+	}
+	return TEST_DONE();
+}
@@ -0,0 +1,214 @@
+/* PWM widths: every width sent lands in the schedule the ISR takes next, in
+ * the order sent, however many come between two frame starts, and the
+ * schedule stays sorted with one edge per distinct width. The ISR plays every
+ * width to the cycle, whether its edge has an interrupt of its own or is
+ * polled behind a close one. */
+
+#include "test.h"
+#include <avr/io.h>
+
+/* Timer1 at /1 in CTC with TOP = OCR1A for the ISR: each register access
+ * moves the clock a few cycles and PORTB writes are logged with the time.
+ * TOV0 marks a TIFR read, a write (1 to clear) takes it away. */
+#define TCNT1	(*simTcnt1())
+#define TIFR	(*simTifr())
+#define PORTB	(*simPortb())
+
+static uint32_t simNow;			/* cycles */
+static uint32_t simOff;			/* TCNT1 at simNow 0 */
+static uint32_t simCleared;		/* OCF1A written at this time */
+static uint32_t simLast;
+static uint16_t simTcnt;
+static uint8_t simFlags;
+static uint8_t simLog[256];
+static uint32_t simAt[256];
+static uint16_t simWrites;
+
+/* Top matches up to time x */
+static uint32_t simMatches(uint32_t x){
+	return (x + simOff + 1) / ((uint32_t)OCR1A + 1);
+}
+
+static volatile uint16_t *simTcnt1( void ){
+	simNow += 3;
+	simTcnt = (simNow + simOff) % ((uint32_t)OCR1A + 1);
+	return &simTcnt;
+}
+
+static volatile uint8_t *simTifr( void ){
+	if(!(simFlags & (1 << TOV0)) && (simFlags & (1 << OCF1A))){
+		simCleared = simLast;
+	}
+	simNow += 2;
+	simLast = simNow;
+	simFlags = (1 << TOV0);
+	if(simMatches(simNow) > simMatches(simCleared)){
+		simFlags |= (1 << OCF1A);
+	}
+	return &simFlags;
+}
+
+static volatile uint8_t *simPortb( void ){
+	simNow += 1;
+	simAt[simWrites] = simNow;
+	return &simLog[simWrites++ & 0xFF];
+}
+
+#define main generator_main
+#include "main.c"
+#undef main
+
+static uint32_t seed = 1;
+
+static uint16_t rnd( void ){
+	seed = seed * 1103515245 + 12345;
+	return seed >> 16;
+}
+
+/* Width of a channel as the ISR would play it, top + 1 for a channel high
+ * the whole frame */
+static uint16_t played(const pwm_t *p, uint8_t ch){
+	uint8_t bit = 1 << ch;
+	uint8_t i;
+
+	if(!(p->start & bit)){
+		return 0;
+	}
+	for(i = 0; i < p->count; i++){
+		if(!(p->level[i] & bit)){
+			return p->time[i] + 1;
+		}
+	}
+	return (uint16_t)plan.lowCount + 1;
+}
+
+/* Ascending edges, each one drops at least one channel and never raises one */
+static bool sorted(const pwm_t *p){
+	uint8_t level = p->start;
+	uint8_t i;
+
+	if(p->count > PWM_CHANNELS){
+		return false;
+	}
+	for(i = 0; i < p->count; i++){
+		if((i && (p->time[i] <= p->time[i - 1])) || (p->level[i] == level) ||
+				(p->level[i] & ~level)){
+			return false;
+		}
+		level = p->level[i];
+	}
+	return true;
+}
+
+static void frame(uint32_t cycles, uint32_t n){
+	uint16_t want[PWM_CHANNELS] = { 0 };
+	uint16_t top, t;
+	uint8_t ch, k;
+	bool ok = true;
+
+	makePwmFrame(cycles);
+	pwmCur = 0;
+	pwmSwap = false;
+	top = (uint16_t)plan.lowCount;
+	while(n--){
+		/* a burst of widths between two frame starts */
+		for(k = rnd() % 12; k; k--){
+			ch = rnd() % PWM_CHANNELS;
+			switch(rnd() % 4){
+			case 0:
+				t = rnd() % (2 * pwmNear);	/* short ones and 0 */
+				break;
+			case 1:
+				t = top - 2 + rnd() % 5;	/* around the frame */
+				break;
+			case 2:
+				t = want[rnd() % PWM_CHANNELS];	/* equal widths */
+				break;
+			default:
+				t = rnd() % (top + 1);
+			}
+			pwmSet(ch, t);
+			if(t && (t < pwmNear)){
+				t = pwmNear;
+			}
+			want[ch] = (t > top) ? top + 1 : t;
+		}
+		if(pwmSwap){
+			pwmCur ^= 1;	/* the ISR at the frame start */
+			pwmSwap = false;
+		}
+		ok = ok && sorted(&pwmBuf[pwmCur]);
+		for(ch = 0; ch < PWM_CHANNELS; ch++){
+			ok = ok && (played(&pwmBuf[pwmCur], ch) == want[ch]);
+		}
+	}
+	CHECK(ok);
+}
+
+/* Plays 2000 cycle frames through pwmIsr, entered lat cycles after each
+ * compare B match, and checks every pulse against its width */
+static void timing(const uint16_t *w, uint8_t lat){
+	uint32_t rise[PWM_CHANNELS] = { 0 };
+	uint32_t top, tc;
+	uint16_t k;
+	int32_t err, lo = 0x7FFF, hi = -0x7FFF;
+	uint8_t ch, prev = 0, up, down;
+	uint16_t pulses = 0;
+
+	makePwmFrame(2000);
+	pwmCur = 0;
+	pwmSwap = false;
+	for(ch = 0; ch < PWM_CHANNELS; ch++){
+		pwmSet(ch, w[ch]);
+	}
+
+	/* doPwm */
+	pwmEdge = pwmBuf[pwmCur].count;
+	OCR1A = (uint16_t)plan.lowCount;
+	OCR1B = OCR1A - pwmEarly;
+	top = OCR1A;
+	simOff = top - pwmNear;
+	simNow = 0;
+	simCleared = 0;
+	simFlags = (1 << TOV0);
+	simWrites = 0;
+
+	while(simWrites < 200){
+		tc = (simNow + simOff) % (top + 1);
+		simNow += ((OCR1B > tc) ? OCR1B - tc : OCR1B + top + 1 - tc) + lat;
+		pwmIsr();
+	}
+
+	for(k = 0; k < 200; k++){
+		up = simLog[k] & ~prev;
+		down = prev & ~simLog[k];
+		prev = simLog[k];
+		for(ch = 0; ch < PWM_CHANNELS; ch++){
+			if(up & (1 << ch)){
+				rise[ch] = simAt[k];
+			}
+			if((down & (1 << ch)) && rise[ch]){
+				err = (int32_t)(simAt[k] - rise[ch]) - w[ch];
+				lo = (err < lo) ? err : lo;
+				hi = (err > hi) ? err : hi;
+				pulses++;
+			}
+		}
+	}
+	/* the same few cycles of poll for every channel */
+	CHECK(hi - lo <= 6);
+	CHECK((lo >= -8) && (hi <= 8));
+	CHECK(pulses > 100);
+}
+
+int main( void ){
+	/* 50 and 30 cycles apart, one near the frame start, one near its end */
+	static const uint16_t w[PWM_CHANNELS] = { 500, 550, 1950, 120, 1000, 0, 1999, 1030 };
+
+	frame(20000, 100000);			/* 1 cycle steps */
+	frame(400000, 100000);			/* 20ms servo frame, /8 */
+	frame(2 * PWM_NEAR, 10000);		/* shortest frame, most widths clamp */
+	timing(w, 40);
+	timing(w, 75);
+	return TEST_DONE();
+}
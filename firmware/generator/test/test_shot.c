@@ -0,0 +1,157 @@
+/* Double pulse: every edge of a shot comes to the cycle with ISRs of up to
+ * SHOT_SAFE / 2 cycles thrown in wherever interrupts are on, and interrupts
+ * are off only around the matches with a short phase after them, not for the
+ * whole shot. */
+
+#include "test.h"
+#include <stdbool.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+/* Timer1 free running at /1 in normal mode: each register access moves the
+ * clock a few cycles, or a whole ISR when interrupts are on, and a compare B
+ * match on the way sets OCF1B and OC1B as TCCR1A had it. TOV0 marks TIFR as
+ * read, without it TIFR was written and the bits written 1 are cleared. */
+#undef cli
+#undef sei
+#define cli()	simCli()
+#define sei()	simSei()
+#define TCNT1	(*simTcnt1())
+#define TIFR	(*simTifr())
+#define OCR1B	(*simOcr1b())
+#define TCCR1A	(*simTccr1a())
+#define UCSRA	(*simUcsra())
+
+static uint64_t simNow;
+static uint64_t simOff;			/* cli() at this time */
+static uint64_t simLongest;		/* longest cli() to sei() */
+static bool simI = true;
+static uint16_t simTcnt, simOcr;
+static uint8_t simFlags = (1 << TOV0), simReal;
+static uint8_t simTccr, simLevel, simUcsr;
+static uint64_t simAt[16];
+static uint8_t simLog[16];
+static uint8_t simEdges;
+static uint32_t simSeed = 1;
+static uint16_t simIsrMax;
+
+static uint32_t simRnd( void ){
+	simSeed = simSeed * 1103515245 + 12345;
+	return simSeed >> 8;
+}
+
+static void simRun(uint32_t cycles){
+	uint64_t t0 = simNow;
+	uint64_t match;
+	uint8_t level;
+
+	if(!(simFlags & (1 << TOV0))){
+		simReal &= ~simFlags;
+	}
+	if(simI && simIsrMax && ((simRnd() % 64) == 0)){
+		cycles += simRnd() % simIsrMax;
+	}
+	simNow += cycles;
+	match = t0 + 1 + (uint16_t)(simOcr - (uint16_t)(t0 + 1));
+	if(match <= simNow){
+		simReal |= (1 << OCF1B);
+		level = (simTccr & (1 << COM1B0)) ? 1 : 0;
+		if((level != simLevel) && (simEdges < 16)){
+			simAt[simEdges] = match;
+			simLog[simEdges++] = level;
+		}
+		simLevel = level;
+	}
+	simFlags = simReal | (1 << TOV0);
+}
+
+static void simCli( void ){
+	simRun(1);
+	if(simI){
+		simOff = simNow;
+	}
+	simI = false;
+}
+
+static void simSei( void ){
+	simRun(1);
+	if(!simI && (simNow - simOff > simLongest)){
+		simLongest = simNow - simOff;
+	}
+	simI = true;
+}
+
+static volatile uint16_t *simTcnt1( void ){
+	simRun(3);
+	simTcnt = (uint16_t)simNow;
+	return &simTcnt;
+}
+
+static volatile uint8_t *simTifr( void ){
+	simRun(2);
+	return &simFlags;
+}
+
+static volatile uint16_t *simOcr1b( void ){
+	simRun(3);
+	return &simOcr;
+}
+
+static volatile uint8_t *simTccr1a( void ){
+	simRun(1);
+	return &simTccr;
+}
+
+static volatile uint8_t *simUcsra( void );
+
+#define main generator_main
+#include "main.c"
+#undef main
+
+/* UDRE always, the engine is sent away once its reply is out */
+static volatile uint8_t *simUcsra( void ){
+	if(txLeft <= 1){
+		modeContinueFlag = false;
+	}
+	simUcsr = (1 << UDRE);
+	return &simUcsr;
+}
+
+/* One shot from command 20 0, each edge checked against the phases */
+static void shot(uint32_t first, uint32_t gap, uint32_t second, uint32_t longest){
+	uint64_t at;
+	uint32_t cnt = shotCount;
+
+	shotLen[0] = first;
+	shotLen[1] = gap;
+	shotLen[2] = second;
+	simEdges = 0;
+	simLevel = 0;
+	simLongest = 0;
+	simReal = 0;
+	simFlags = (1 << TOV0);
+	simI = true;
+	plan.lowRem = SHOT_NOW;
+	modeContinueFlag = true;
+	at = simNow;
+	doShot();
+
+	CHECK(shotCount == cnt + 1);
+	CHECK(simEdges == 4);
+	CHECK((simLog[0] == 1) && (simLog[1] == 0) && (simLog[2] == 1) && (simLog[3] == 0));
+	CHECK((simAt[0] > at + SHOT_LEAD) && (simAt[0] < at + SHOT_LEAD + 32));
+	CHECK(simAt[1] - simAt[0] == first);
+	CHECK(simAt[2] - simAt[1] == gap);
+	CHECK(simAt[3] - simAt[2] == second);
+	CHECK(simLongest <= longest);
+}
+
+int main( void ){
+	simIsrMax = SHOT_SAFE / 2;
+	shot(2000, 200, 200, SHOT_LEAD + 2400 + 200);	/* short, all with interrupts off */
+	shot(0xFFFFFF, 0xFFFFFF, 0xFFFFFF, SHOT_LEAD + 200);	/* 2,5s, only the lead */
+	shot(100000, 200, 5000000, SHOT_SAFE + 200 + 200);	/* off around the gap */
+	shot(SHOT_SAFE, SHOT_MIN, 0x10000, SHOT_SAFE + SHOT_MIN + 200);
+	shot(0x10001, SHOT_SAFE - 1, 0x18000, 2 * SHOT_SAFE + 200);
+	return TEST_DONE();
+}
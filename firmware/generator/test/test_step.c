@@ -0,0 +1,91 @@
+/* Stepper ramp: the intervals doStep hands to the ISR keep c = floor(sqrt(K /
+ * n)) on the way up, the way down mirrors it, and a move takes within 2% of
+ * the ideal constant acceleration trapezoid (triangle when it is short), less
+ * the head start of the first steps. */
+
+#include "test.h"
+#include <math.h>
+#define main generator_main
+#include "main.c"
+#undef main
+
+static uint16_t iv[20000];
+
+/* K of stepSetup, in ticks of the prescaller it picks */
+static uint64_t rampK(uint32_t accel, uint8_t *shift){
+	*shift = (accel >= 1456) ? 3 : ((accel >= 23) ? 6 : 8);
+	return (uint64_t)(STEP_KA / accel) << (2 * (8 - *shift));
+}
+
+/* The intervals between the steps of a move, in the order doStep computes them */
+static uint32_t move(uint32_t steps){
+	uint32_t n = 0;
+	uint32_t left;
+
+	stepSetup();
+	iv[n++] = (stepC < stepMin) ? stepMin : stepC;
+	if(steps > 2){
+		iv[n++] = stepAdvance(steps - 2);
+		for(left = steps - 3; left > 0; left--){
+			iv[n++] = stepAdvance(left);
+		}
+	}
+	return n;
+}
+
+static void ramp(uint32_t rate, uint32_t accel, uint32_t steps){
+	uint64_t k, c;
+	uint32_t n, i, up;
+	uint8_t shift;
+	double t = 0, ideal, d, v, a, c1;
+	bool ok = true;
+
+	stepRate = rate;
+	stepAccel = accel;
+	k = rampK(accel, &shift);
+	n = move(steps);
+	CHECK(n == steps - 1);
+
+	/* Floor square root on the way up, until the top rate */
+	for(i = 0, up = 1; (i < n / 2) && (iv[i] > stepMin); i++, up++){
+		c = (uint64_t)sqrt((double)k / up);
+		while(c * c * up > k){
+			c--;
+		}
+		while((c + 1) * (c + 1) * up <= k){
+			c++;
+		}
+		ok = ok && (iv[i] == c);
+	}
+	CHECK(ok);
+
+	ok = true;
+	for(i = 0; i < n; i++){
+		ok = ok && (iv[i] == iv[n - 1 - i]) && (iv[i] >= stepMin);
+		t += iv[i];
+	}
+	CHECK(ok);
+
+	/* From the first step to the last, steps - 1 steps apart. The sum of
+	 * 1 / sqrt(n) falls short of 2 sqrt(N) by ~1,46, so each ramp runs ahead
+	 * of the ideal by about 1,5 first intervals, which only matters for short
+	 * moves. */
+	t *= (double)(1UL << shift) / F_CPU;
+	c1 = (double)stepC1 * (1UL << shift) / F_CPU;
+	d = steps - 1;
+	v = (double)(F_CPU >> shift) / stepMin;
+	a = accel;
+	ideal = (d >= v * v / a) ? (d / v + v / a) : (2 * sqrt(d / a));
+	CHECK(t < ideal + 0.02 * ideal);
+	CHECK(t > ideal - 0.02 * ideal - 3 * c1);
+}
+
+int main( void ){
+	ramp(1000, 2000, 200);			/* trapezoid at /8 */
+	ramp(1000, 2000, 2000);
+	ramp(50000, 100000, 10000);		/* near the top rate */
+	ramp(20000, 500, 5000);			/* triangle at /64 */
+	ramp(200, 10, 301);				/* /256, odd count */
+	ramp(62500, 1456, 19999);
+	return TEST_DONE();
+}